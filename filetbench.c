@@ -0,0 +1,115 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Benchmark for the filetwm layout and stacking hot paths.
+ *
+ * This builds filetwm's own code (it includes filetwm.c) and drives it
+ * as the window manager of a display, against a synthetic set of client
+ * windows, reporting the time and X requests taken by each operation.
+ * Run it against a spare display, such as a virtual framebuffer:
+ *
+ * xvfb-run -s "-screen 0 3840x1080x24" ./filetbench 300 4 50 5
+ *
+ * Arguments are all optional and in order:
+ *  windows => number of client windows (default 100).
+ *  monitors => number of monitors splitting the screen (default 1).
+ *  tiled => percent of windows in the tiling layer (default 50).
+ *  fullscreen => percent of windows that are fullscreen (default 0).
+ *  iterations => repetitions of each operation (default 1000).
+ *
+ * Times include the X server processing, as each operation
+ * is followed by a sync before the clock is read.
+ */
+
+#define main filetwmmain
+#include "filetwm.c"
+#undef main
+
+/* drop any events queued by the operations, without a round trip,
+   so deferral (see arrange and restack) never kicks in */
+#define DRAIN() {XEvent _ev; while (XQLength(dpy)) XNextEvent(dpy, &_ev);}
+#define CFGBURST 8 /* configure requests queued together */
+/* time an operation over the iterations, with a client to act on (c) */
+#define BENCH(NAME, OP) {\
+	start = nsnow(); req = NextRequest(dpy);\
+	for (i = 0; i < iters; i++) {\
+		c = all[i % n];\
+		OP;\
+		DRAIN()\
+	}\
+	XSync(dpy, True);\
+	printf("%-10s %12.3f us/op %10.1f requests/op\n", NAME,\
+		(nsnow() - start) / 1e3 / iters, (double)(NextRequest(dpy) - req) / iters);}
+
+int main(int argc, char *argv[]) {
+	int i, m, n, nm, tiled, full, iters, calls;
+	long long start;
+	unsigned long req;
+	Client *c, **all;
+	XEvent ev;
+
+	n = MAX(1, argc > 1 ? atoi(argv[1]) : 100);
+	nm = MAX(1, argc > 2 ? atoi(argv[2]) : 1);
+	tiled = argc > 3 ? atoi(argv[3]) : 50;
+	full = argc > 4 ? atoi(argv[4]) : 0;
+	iters = MAX(1, argc > 5 ? atoi(argv[5]) : 1000);
+	if (!getenv("DISPLAY"))
+		DIE("filetbench: needs a spare display (e.g. use xvfb-run).\n");
+
+	setup();
+	/* split the screen into the monitors */
+	if (!(mons = calloc(nm, sizeof(Monitor))) || !(all = calloc(n, sizeof *all)))
+		DIE("calloc failed.\n");
+	for (monslen = nm, m = 0; m < nm; m++)
+		mons[m] = (Monitor){m * sw / nm, 0, sw / nm, sh};
+	updatemonindex();
+
+	/* manage the synthetic client windows, spread over the monitors */
+	for (i = 0; i < n; i++) {
+		m = i % nm;
+		maprequest(&(XEvent){.xmaprequest = {.type = MapRequest,
+			.window = XCreateSimpleWindow(dpy, root, mons[m].mx + (i * 37) % 200,
+				(i * 23) % 200, 300 + i % 100, 200 + i % 50, 0, 0, 0)}});
+		all[i] = clients;
+		all[i]->tile = i * 100 / n < tiled;
+		all[i]->chain = i % 3 != 0;
+		if ((n - 1 - i) * 100 / n < full)
+			setfullscreen(all[i], 1);
+		DRAIN()
+	}
+	arrange(NULL, 0);
+	XSync(dpy, True);
+
+	printf("%d windows, %d monitors, %d%% tiled, %d%% fullscreen, %d iterations\n",
+		n, nm, tiled, full, iters);
+
+	/* time a burst of configure requests queued for a floating window,
+	   counting the handler calls taken (see configurerequest) */
+	for (i = 0; i < n && (all[i]->tile || all[i]->full); i++);
+	if (i < n) {
+		c = all[i];
+		start = nsnow();
+		req = NextRequest(dpy);
+		for (m = CFGBURST; m > 0; m--)
+			XPutBackEvent(dpy, &(XEvent){.xconfigurerequest = {
+				.type = ConfigureRequest, .parent = root, .window = c->win,
+				.x = c->fx, .y = c->fy, .width = c->fw + m, .height = c->fh,
+				.value_mask = CWX|CWY|CWWidth|CWHeight}});
+		for (calls = 0; XCheckTypedEvent(dpy, ConfigureRequest, &ev); calls++)
+			configurerequest(&ev);
+		XSync(dpy, True);
+		printf("%-10s %12.3f us/burst %8lu requests/burst %4d calls for %d queued\n",
+			"configure", (nsnow() - start) / 1e3, NextRequest(dpy) - req,
+			calls, CFGBURST);
+	}
+
+	BENCH("arrange", arrange(NULL, 0))
+	BENCH("restack", restack(c, CliRaise))
+	BENCH("focus", focus(c))
+	BENCH("resize", resize(c, c->fx + (i % 2 ? 1 : -1), c->fy, c->fw, c->fh, 1))
+	BENCH("drag", resize(c, c->x + (i % 2 ? 8 : -8), c->y, c->w, c->h, 1);
+		if (c->tile) arrange(c, 0))
+	BENCH("view", view(&(Arg){.ui = i % 2 ? 1 : ~0}))
+
+	XCloseDisplay(dpy);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Replay benchmark for the filetwm event handlers, from a recorded trace.
+ *
+ * This builds filetwm's own code (it includes filetwm.c) and feeds a
+ * recorded event stream back through the same handlers, as the window
+ * manager of a display, reporting the time and X requests taken by each
+ * handler and hot path (see dumpstats). Record a trace by running filetwm
+ * with the FILETWMTRACE environment variable set to the trace file path,
+ * then replay it against a spare display, such as a virtual framebuffer:
+ *
+ * xvfb-run -s "-screen 0 3840x1080x24" ./filetreplay trace
+ *
+ * Each recorded event is queued along with the events that were queued
+ * behind it, so deferred processing runs as it did when recorded.
+ * The clients of the trace are replaced with synthetic windows, and the
+ * display's own events are dropped, so a trace replays the same way
+ * every time. Each run (a restart) starts afresh: the clients of the
+ * run before are unmanaged, and those that were managed when the run
+ * started are managed again, neither counted in the statistics. Events
+ * for windows without a replay window (such as unmanaged popups) are
+ * skipped. Extension and generic events (screen changes, raw input)
+ * aren't replayed.
+ */
+
+#define main filetwmmain
+#include "filetwm.c"
+#undef main
+
+#define REPLAYSERIAL (~0UL) /* marks the replayed events in the queue */
+#define REMAP(W) W = remap(W)
+
+static Window *from = NULL, *to = NULL; /* recorded and replay windows */
+static int mapslen = 0, mapssize = 0;
+
+
+/**
+ * Point a recorded window at a replay window, replacing any earlier one.
+ */
+void addmap(Window w, Window r) {
+	int i;
+
+	for (i = 0; i < mapslen && from[i] != w; i++);
+	if (i == mapssize && (!(from = realloc(from,
+		(mapssize = 2 * mapssize + 64) * sizeof(Window)))
+		|| !(to = realloc(to, mapssize * sizeof(Window)))))
+		DIE("realloc failed.\n");
+	mapslen += i == mapslen;
+	from[i] = w;
+	to[i] = r;
+}
+
+
+/**
+ * Count the replayed events in the queue (see XCheckIfEvent).
+ */
+Bool isreplayed(Display *dpy, XEvent *e, XPointer arg) {
+	*(int *)arg += e->xany.serial == REPLAYSERIAL;
+	return False;
+}
+
+
+/**
+ * Returns the replay window of a recorded window,
+ * or None if it has none.
+ */
+Window remap(Window w) {
+	int i;
+
+	for (i = 0; i < mapslen && from[i] != w; i++);
+	return i < mapslen ? to[i] : None;
+}
+
+
+/**
+ * Point the windows of a recorded event at the replay windows,
+ * and mark it as replayed.
+ * Returns false if the window the event is for has no replay window
+ * (such as windows that were never managed), so it can be skipped.
+ */
+int remapevent(XEvent *e) {
+	Window *w = &e->xany.window; /* the window the event is for */
+
+	e->xany.display = dpy;
+	e->xany.serial = REPLAYSERIAL;
+	REMAP(e->xany.window);
+	switch (e->type) {
+	case MapRequest:
+		w = &e->xmaprequest.window;
+		break;
+	case ConfigureRequest:
+		w = &e->xconfigurerequest.window;
+		REMAP(e->xconfigurerequest.above);
+		break;
+	case DestroyNotify:
+		w = &e->xdestroywindow.window;
+		break;
+	case UnmapNotify:
+		w = &e->xunmap.window;
+		break;
+	case ButtonPress:
+	case ButtonRelease:
+		REMAP(e->xbutton.root);
+		REMAP(e->xbutton.subwindow);
+		break;
+	case KeyPress:
+	case KeyRelease:
+		REMAP(e->xkey.root);
+		REMAP(e->xkey.subwindow);
+		break;
+	case MotionNotify:
+		REMAP(e->xmotion.root);
+		REMAP(e->xmotion.subwindow);
+		break;
+	case EnterNotify:
+	case LeaveNotify:
+		REMAP(e->xcrossing.root);
+		REMAP(e->xcrossing.subwindow);
+	}
+	if (w != &e->xany.window)
+		REMAP(*w);
+	return *w != None;
+}
+
+
+/**
+ * Returns a synthetic window for replaying a recorded client.
+ */
+Window replaywin(void) {
+	return XCreateSimpleWindow(dpy, root, (mapslen * 37) % 200,
+		(mapslen * 23) % 200, 300 + mapslen % 100, 200 + mapslen % 50, 0, 0, 0);
+}
+
+
+int main(int argc, char *argv[]) {
+	int i, j, k, o, left, n = 0, size = 0, runs = 0, managed = 0, skipped = 0;
+	Stat kept[StatLast];
+	Trace *t = NULL;
+	XEvent ev, *e;
+	FILE *f;
+
+	if (argc != 2)
+		DIE("usage: filetreplay trace\n");
+	if (!getenv("DISPLAY"))
+		DIE("filetreplay: needs a spare display (e.g. use xvfb-run).\n");
+	if (!(f = fopen(argv[1], "r")))
+		DIE("filetreplay: cannot open the trace.\n");
+	for (;;) {
+		if (n == size && !(t = realloc(t, (size = 2 * n + 1024) * sizeof(Trace))))
+			DIE("realloc failed.\n");
+		if (fread(&t[n], sizeof(Trace), 1, f) != 1) break;
+		/* keep the leading entries and the core events */
+		if (t[n].qlen < 0 || (t[n].ev.type < LASTEvent
+		&& t[n].ev.type != GenericEvent)) n++;
+	}
+	fclose(f);
+	if (!n || t[0].qlen != -1)
+		DIE("filetreplay: not an event trace.\n");
+
+	unsetenv("FILETWMTRACE");
+	setup();
+	framens = 0; /* apply drag movements without pacing (see dragframe) */
+
+	/* point the windows of each run at the replay display's windows,
+	   adding synthetic windows for the clients, and skipping events
+	   for windows that have no replay window */
+	for (i = o = 0; i < n; i++) {
+		e = &t[i].ev;
+		if (t[i].qlen == -1) {
+			addmap(e->xclient.window, root);
+			addmap(e->xclient.data.l[0], barwin);
+			runs++;
+			t[o++] = t[i];
+			continue;
+		}
+		if ((t[i].qlen == -2 || e->type == MapRequest
+		|| e->type == ConfigureRequest) && !remap(e->xmaprequest.window))
+			addmap(e->xmaprequest.window, replaywin());
+		if (!remapevent(e)) {
+			/* drop the skipped event from the queues recorded before it */
+			for (j = o - 1; j >= 0 && t[j].qlen >= 0; j--)
+				if (j + t[j].qlen >= o) t[j].qlen--;
+			skipped++;
+		} else {
+			managed += t[i].qlen == -2;
+			t[o++] = t[i];
+		}
+	}
+	n = o;
+	XSync(dpy, False);
+	memset(stats, 0, sizeof stats);
+
+	for (i = 0; i < n;) {
+		/* drop the display's own events */
+		XSync(dpy, False);
+		while (XQLength(dpy))
+			XNextEvent(dpy, &ev);
+		/* start a run afresh, as the restart did, without counting it:
+		   unmanaging the clients of the run before, then managing those
+		   that were managed when the run started */
+		if (t[i].qlen < 0) {
+			memcpy(kept, stats, sizeof stats);
+			if (t[i].qlen == -1)
+				while (clients)
+					unmanage(clients);
+			else maprequest(&t[i].ev);
+			memcpy(stats, kept, sizeof stats);
+			i++;
+			continue;
+		}
+		/* queue the event with those queued behind it, within its run */
+		for (k = 0; k < t[i].qlen && i + k + 1 < n && t[i + k + 1].qlen >= 0; k++);
+		for (j = i + k; j >= i; j--)
+			XPutBackEvent(dpy, &t[j].ev);
+		dragframe();
+		XNextEvent(dpy, &ev);
+		dispatch(&ev);
+		/* move past the events taken from the queue */
+		left = 0;
+		XCheckIfEvent(dpy, &ev, isreplayed, (XPointer)&left);
+		i += k + 1 - left;
+	}
+	XSync(dpy, False);
+	fprintf(stderr, "filetreplay: %d events from %d runs, %d windows, %d skipped\n",
+		n - runs - managed, runs, mapslen, skipped);
+	dumpstats();
+
+	XCloseDisplay(dpy);
+	return EXIT_SUCCESS;
+}
@@ -4,7 +4,10 @@
  * window name.
  *
  * Customised to run for filetwm.
- * Continuously sends updated status text to the root window name.
+ * Continuously sends updated status text to the root window name,
+ * updating every few seconds (landing on the clock's minute boundaries),
+ * and whenever a network link or power supply changes. The status is only
+ * sent when the text changes.
  *
  * "{VPN} (1*2%|2456M) [100] FiletLignux 17:22"
  *
@@ -20,56 +23,111 @@
  * to alternatives, and is a perfect learning challenge.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <X11/Xlib.h>
 
-/* load file to buffer - no fault handling, only use on /proc/ files */
-#define GET(F) { f=open(F, O_RDONLY);\
-	r=read(f, buf, 4999*sizeof(char)); buf[r/sizeof(char)] = '\0'; close(f); }
-/* search the buffer to after a string */
-#define SEEK(V, buf) ((b = strstr(buf, V)) ? b += strlen(V) : NULL)
+/* seconds between updates (must divide a minute to keep the clock exact) */
+#define INTERVAL 5
+/* load an open file to buffer, growing the buffer to fit
+   - no fault handling, only use on /proc/ files */
+#define GET(F) { for (r = 0; F >= 0 && (k = pread(F, buf+r, size-r-1, r)) > 0;)\
+		if ((r += k) == size-1 && !(buf = realloc(buf, size *= 2))) return 1;\
+	buf[r] = '\0'; }
+/* parse a decimal number from the buffer position */
+#define NUM(V) for (V = 0; *b >= '0' && *b <= '9'; b++) V = V*10 + *b - '0';
 /* retrieve a 'long' from the buffer after a string */
 #define L(V) (strstr(buf, V) ? strtol(strstr(buf, V)+strlen(V), &dcp, 10) : 0)
-/* load the battery file to buffer with GET */
-#define BAT(F) { GET("/sys/class/power_supply/BAT0/"F);\
-		if (f<0) GET("/var/battery/"F); }
+/* open the battery file for reading with GET */
+#define BAT(F, V) { if ((V = open("/sys/class/power_supply/BAT0/"F, O_RDONLY)) < 0)\
+		V = open("/var/battery/"F, O_RDONLY); }
+/* watch a file descriptor for input */
+#define WATCH(F) epoll_ctl(ep, EPOLL_CTL_ADD, F,\
+	&(struct epoll_event){.events = EPOLLIN, .data.fd = F})
+/* arm the timer for each interval on the clock, until the clock is set */
+#define ARM(T) { clock_gettime(CLOCK_REALTIME, &ts);\
+	timerfd_settime(T, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,\
+		&(struct itimerspec){{INTERVAL, 0},\
+		{ts.tv_sec - ts.tv_sec % INTERVAL + INTERVAL, 0}}, NULL); }
 
 int
 main(int argc, char *argv[])
 {
-	int f, r, i, j, vpn, charge;
-	long bat, delta, idle, cpu, mem, maxcpu, totcpu;
-	/* only b up to 64 CPUs */
-	static long ctimelast[64] = {0}, cidlelast[64] = {0};
-	char buf[5000] = {[4999] = '\0'}, *b, *dcp;
+	int f, r, k, i, j, n, vpn, charge, wake, ep, tfd, rtnl, uev, net, stat,
+		meminfo, cap, status, ncpu = 0, size = 5000;
+	long bat, delta, idle, cpu, mem, maxcpu, totcpu, v;
+	/* accumulated times of each cpu, grown for the cpus found */
+	long *ctimelast = NULL, *cidlelast = NULL;
+	char *buf = calloc(size, sizeof(char)), *b, *dcp, text[256], last[256] = "";
+	unsigned long long ticks;
 	time_t now;
+	struct timespec ts;
+	struct epoll_event evs[3];
 	Display *dpy = XOpenDisplay(NULL);
 	Window root = RootWindow(dpy, DefaultScreen(dpy));
 
+	/* keep the status files open, for reading again from the start */
+	net = open("/proc/net/dev", O_RDONLY);
+	stat = open("/proc/stat", O_RDONLY);
+	meminfo = open("/proc/meminfo", O_RDONLY);
+	BAT("capacity", cap);
+	BAT("status", status);
+
+	/* wake for the interval timer, network link changes (rtnetlink),
+	   and power supply changes (kernel uevents) */
+	ep = epoll_create1(0);
+	tfd = timerfd_create(CLOCK_REALTIME, 0);
+	ARM(tfd);
+	WATCH(tfd);
+	rtnl = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (!bind(rtnl, (struct sockaddr *)&(struct sockaddr_nl){
+		.nl_family = AF_NETLINK, .nl_groups = RTMGRP_LINK}, sizeof(struct sockaddr_nl)))
+		WATCH(rtnl);
+	uev = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (!bind(uev, (struct sockaddr *)&(struct sockaddr_nl){
+		.nl_family = AF_NETLINK, .nl_groups = 1}, sizeof(struct sockaddr_nl)))
+		WATCH(uev);
+
 	while (1) {
 
 		/* check for vpn */
-		GET("/proc/net/dev");
+		GET(net);
 		vpn = r && strstr(buf, "tun0");
 
 		/* cpu utilisation */
 		maxcpu = totcpu = 0;
-		GET("/proc/stat");
-		/* skip the cpu totals line */
-		SEEK("cpu", buf);
-		/* parse each cpu line */
-		for (j = 0; SEEK("cpu", b) && (b = strstr(b, " ")) && j < 64; j++) {
+		GET(stat);
+		/* parse each cpu line after the cpu totals line */
+		for (j = 0, b = buf; (b = strchr(b, '\n')) && !strncmp(++b, "cpu", 3); j++) {
+			if (j == ncpu) {
+				ncpu = 2 * ncpu + 64;
+				if (!(ctimelast = realloc(ctimelast, ncpu * sizeof(long)))
+				|| !(cidlelast = realloc(cidlelast, ncpu * sizeof(long))))
+					return 1;
+				memset(&ctimelast[j], 0, (ncpu - j) * sizeof(long));
+				memset(&cidlelast[j], 0, (ncpu - j) * sizeof(long));
+			}
+			/* skip the cpu number, then total the times after each space */
+			b += 3;
+			NUM(v)
 			idle = -cidlelast[j];
 			delta = -ctimelast[j];
-			for (i = 0; !strncmp(b, " ", strlen(" ")); i++) {
+			for (i = 0; *b == ' '; i++) {
+				b++;
+				NUM(v)
 				if (i == 3 || i == 4)
-					idle += strtol(b, &dcp, 10);
-				delta += strtol(b, &b, 10);
+					idle += v;
+				delta += v;
 			}
 			/* update maxcpu and totcpu */
 			if ((cpu = (delta-idle)*100/(delta?delta:1)) > maxcpu)
@@ -81,26 +139,45 @@ main(int argc, char *argv[])
 		}
 
 		/* memory used */
-		GET("/proc/meminfo");
+		GET(meminfo);
 		mem = L("mTotal:")-L("mFree:")-L("Buffers:")-L("Cached:")-L("claimable:");
 
 		/* battery levels */
-		BAT("capacity");
+		GET(cap);
 		bat = L("");
 		/* battery charging */
-		BAT("status");
+		GET(status);
 		charge = 0==strncmp(buf, "Charging", 8);
 
 		/* time */
 		now = time(0);
 
-		/* send output and wait interval */
-		snprintf(buf, 4999*sizeof(char), "%s(%ld*%ld%%|%ldM) [%ld%s] %02d:%02d",
+		/* send output, only if it changed */
+		snprintf(text, sizeof text, "%s(%ld*%ld%%|%ldM) [%ld%s] %02d:%02d",
 			vpn?"{VPN} ":"", totcpu/(maxcpu?maxcpu:1), maxcpu, mem/1024, bat,
 			charge?"+":"", localtime(&now)->tm_hour, localtime(&now)->tm_min);
-		XStoreName(dpy, root, (char *)buf);
-		XSync(dpy, False);
-		sleep(5);
+		if (strcmp(text, last)) {
+			XStoreName(dpy, root, text);
+			XSync(dpy, False);
+			strcpy(last, text);
+		}
+
+		/* wait for the next interval, or a relevant change */
+		for (wake = 0; !wake;)
+			for (n = epoll_wait(ep, evs, 3, -1); n-- > 0;) {
+				if ((f = evs[n].data.fd) == tfd) {
+					/* rearm after the clock is set (e.g. resuming from sleep) */
+					if (read(tfd, &ticks, sizeof ticks) < 0 && errno == ECANCELED)
+						ARM(tfd);
+					wake = 1;
+				}
+				/* drain the events, only waking for power supply kernel
+				   events (named by the first field) or link changes */
+				while (f != tfd && (r = recv(f, buf, size-1, MSG_DONTWAIT)) > 0) {
+					buf[r] = '\0';
+					wake |= f == rtnl || strstr(buf, "/power_supply/");
+				}
+			}
 
 	}
 }
@@ -12,7 +12,8 @@
  * Each child of the root window is called a client, except windows which have
  * set the override_redirect flag. Clients are organized in a linked client
  * list. Each client contains a bit array to indicate the tags (workspaces)
- * of a client.
+ * of a client. Clients are also indexed by their window in a small hash
+ * table, so events can be matched to their client in O(1) time.
  *
  * Keyboard shortcuts are organized as arrays.
  *
@@ -28,20 +29,26 @@
 #include <dlfcn.h>
 #include <dirent.h>
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/extensions/XInput2.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/sync.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/XF86keysym.h>
 #include <X11/Xft/Xft.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 
@@ -49,7 +56,9 @@
 #define DIE(M) {fputs(M, stderr); exit(1);}
 #define LOADCONF(P,C) ((*(void **)(&C)) = dlsym(dlopen(P, RTLD_LAZY), "config"))
                      /* leave the loaded lib in memory until process cleanup */
-#define KEYMASK(mask) (mask & (ShiftMask|ControlMask|Mod1Mask|Mod4Mask))
+/* index of the shortcut modifiers of a mask (see keyacts) */
+#define KEYMODS(mask) ((mask & ShiftMask ? 1 : 0) | (mask & ControlMask ? 2 : 0)\
+	| (mask & Mod1Mask ? 4 : 0) | (mask & Mod4Mask ? 8 : 0))
 #define KCODE(keysym) ((KeyCode)(XKeysymToKeycode(dpy, keysym)))
 #define KCHAR(E, C, L) (Xutf8LookupString(XCreateIC(XOpenIM(dpy, 0, 0, 0),\
 	XNInputStyle, XIMPreeditNothing|XIMStatusNothing, NULL), E, C, L, NULL, NULL))
@@ -64,50 +73,74 @@
 #define TEXTW(X) (drawntextwidth(X) + TEXTPAD)
 
 /* edge dragging and region macros*/
+#define OVERLAP(C, X, Y, W, H) (C->x < (X) + (W) && (X) < C->x + WIDTH(C)\
+	&& C->y < (Y) + (H) && (Y) < C->y + HEIGHT(C))
 #define INZONE(C, X, Y) (X >= C->x - C->bw && Y >= C->y - C->bw\
 	&& X <= C->x + WIDTH(C) + C->bw && Y <= C->y + HEIGHT(C) + C->bw)
 #define MOVEZONE(C, X, Y) (INZONE(C, X, Y)\
 	&& (abs(C->x - X) <= C->bw || abs(C->y - Y) <= C->bw))
 #define RESIZEZONE(C, X, Y) (INZONE(C, X, Y)\
 	&& (abs(C->x + WIDTH(C) - X) <= C->bw || abs(C->y + HEIGHT(C) - Y) <= C->bw))
+#define SYNCVALUE(V) ((long long)XSyncValueHigh32(V) << 32 | XSyncValueLow32(V))
 
 /* monitor macros */
 #define BARH (TEXTPAD + 2)
-#define INMON(X, Y, M)\
-	(X >= M.mx && X < M.mx + M.mw && Y >= M.my && Y < M.my + M.mh)
+#define SCREENWAIT 200 /* ms for a burst of screen changes to settle */
 #define MONNULL(M) (M.mx == 0 && M.my == 0 && M.mw == 0 && M.mh == 0)
 #define SETMON(M, R) {M.mx = R.x; M.my = R.y; M.mw = R.width; M.mh = R.height;}
-#define ONMON(C, M) INMON(C->x + WIDTH(C)/2, C->y + HEIGHT(C)/2, M)
+#define ONMON(C) monat(C->x + WIDTH(C)/2, C->y + HEIGHT(C)/2, 0, 0)
 
 /* window macros */
 #define HEIGHT(X) ((X)->h + 2 * (X)->bw)
 #define WIDTH(X) ((X)->w + 2 * (X)->bw)
+#define CLIENTSLAB 64 /* clients allocated together (see newclient) */
+#define SESSIONREC 7 /* values saved per client (see savesession) */
 
 /* virtual desktop macros */
 #define TAGMASK ((1 << tagslen) - 1)
 #define TAGSHIFT(TAGS, I) (I < 0 ? (TAGS >> -I) | (TAGS << (tagslen + I))\
 	: (TAGS << I) | (TAGS >> (tagslen - I)))
 
+/* window to client hash index macros */
+#define WINSLEN 256 /* number of hash buckets (must match the WINHASH range) */
+#define WINHASH(W) (((unsigned int)(W) * 2654435761u) >> 24)
+
+/* spatial hit index macros (a grid of cells over the screen) */
+#define HITN 16 /* number of grid cells across and down the screen */
+#define HITCELL(X, Y) (MAX(0, MIN(HITN-1, (Y) * HITN / sh)) * HITN\
+	+ MAX(0, MIN(HITN-1, (X) * HITN / sw)))
+
 /* launcher macros */
-#define NUMCMDS 8000
-#define LENCMD 64
-#define CMDCMP(I) (strncmp(cmdfilter, cmds[I], strlen(cmdfilter)))
-#define CMDFIND(S,D) {for (int i = S; i>=0 && i<NUMCMDS && cmds[i][0]; i = i D)\
-	if (!CMDCMP(i)) {cmdi = i; break;}}
+#define LENCMD 64 /* maximum length of the typed command filter */
+#define CMDNAME(I) (&cmdnames[cmds[I]]) /* name of a command (PATH order) */
+#define CMDCACHE ".cache/filetwmcmds" /* PATH listing cache (in HOME) */
+/* whether a command (PATH order) is in the sorted range matching the filter */
+#define CMDMATCH(I) (I < cmdslen && cmdrank[I] >= cmdlo[strlen(cmdfilter)]\
+	&& cmdrank[I] < cmdhi[strlen(cmdfilter)])
+#define CMDFIND(S,D) {for (int i = S; i>=0 && i<cmdslen; i = i D)\
+	if (CMDMATCH(i)) {cmdi = i; break;}}
 
 /* enums */
 enum { fg, bg, mark, bdr, selbdr, colslen }; /* colors */
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck, /* EWMH atoms */
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWinDialog, NetClientList, NetCliStack, NetLast,
+       NetWMWinDialog, NetClientList, NetCliStack,
+       NetWMSyncRequest, NetWMSyncCounter, NetWMBypassCompositor, NetLast,
        /* default atoms */
-       WMProtocols, WMDelete, WMState, WMTakeFocus, XAtomLast };
+       WMProtocols, WMDelete, WMState, WMTakeFocus,
+       /* filetwm atoms */
+       FiletSession, XAtomLast };
 /* bar click regions */
 enum { ClkStatus, ClkTagBar, ClkSelTag, ClkLast };
 /* mouse motion modes */
 enum { DragMove, DragSize, WinEdge, ZoomStack, CtrlNone };
 /* window stack actions */
 enum { CliPin, CliRaise, CliZoom, CliRemove, BarShow, BarHide, CliNone };
+/* keys resolved to keycodes (see grabkeys) */
+enum { KcLeft, KcRight, KcReturn, KcBackSpace, KcEscape, KcBarShow,
+       KcStackRelease, KcLast };
+/* statistics slots (after the event types) */
+enum { StatArrange = LASTEvent, StatRestack, StatDrawbar, StatMotion, StatLast };
 
 /* argument template for keyboard shortcut and bar click actions */
 typedef union {
@@ -130,11 +163,33 @@ struct Client {
 	/* actual, and intended (f*) positon and size */
 	int x, y, w, h, fx, fy, fw, fh;
 	int basew, baseh, maxw, maxh, minw, minh, bw, fbw, tile, chain, full;
+	int mon, rows; /* tiling monitor, and rows in its column (if leading) */
+	int sx, sy; /* position last sent to the server (offscreen if hidden) */
+	int rank; /* position in the stack, back to front (see restack) */
+	int protos; /* supported WM_PROTOCOLS, by atom index (see sendevent) */
+	int bypass; /* _NET_WM_BYPASS_COMPOSITOR hint (2: keep compositing) */
 	unsigned int tags;
-	Client *next;
-	Window win;
+	Client *next, *hnext; /* client list and window hash bucket chain */
+	Window win, sib; /* the window, and the window last stacked above it */
 };
 
+/* event loop statistics (see dumpstats) */
+typedef struct {
+	unsigned long count, reqs; /* calls and X requests issued */
+	long long ns, maxns; /* cumulative and maximum time taken */
+} Stat;
+
+/* recorded event trace entry (see traceevent), with a leading entry
+   from each run holding its root and bar windows (in ev.xclient),
+   followed by an entry for each client already managed (the window
+   in ev.xmaprequest) */
+typedef struct {
+	long long ns; /* time since the run started */
+	int qlen; /* events queued behind the event (-1 for a leading entry,
+	             -2 for a managed client entry) */
+	XEvent ev;
+} Trace;
+
 /* keyboard shortcut action */
 typedef struct {
 	unsigned int mod;
@@ -143,17 +198,33 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+/* status text provider plugin (see loadstatus) */
+typedef struct {
+	void (*text)(char *text, int size); /* renders the provider's text */
+	char out[256]; /* the last rendered text */
+} Provider;
+
 /* A monitor could be a connected display.
  * You can also have multiple monitors across displays if you
  * want custom windowing regions. */
 typedef struct { int mx, my, mw, mh; } Monitor; /* windowing region size */
 
+/* tiling layout state of each monitor (see arrange): the current tile,
+ * the columns and rows left to place, the room left for a roaming
+ * active window, and the leader of the column being counted.
+ * This is kept apart from Monitor, which config plugins declare. */
+typedef struct {
+	int x, y, w, h, nw, nh, s;
+	Client *lead;
+} MonLayout;
+
 /* function declarations callable from config plugins */
 void grabresize(const Arg *arg);
 void killclient(const Arg *arg);
 void launcher(const Arg *arg);
 void pin(const Arg *arg);
 void quit(const Arg *arg);
+void restart(const Arg *arg);
 void spawn(const Arg *arg);
 void tag(const Arg *arg);
 void stackgrab(const Arg *arg);
@@ -173,19 +244,30 @@ static void configurerequest(XEvent *e);
 static void destroynotify(XEvent *e);
 static void expose(XEvent *e);
 static void exthandler(XEvent *ev);
+static void focusin(XEvent *e);
 static void grabkeys(XEvent *e);
 static void keypress(XEvent *e);
 static void maprequest(XEvent *e);
+static void motionnotify(XEvent *e);
 static void propertynotify(XEvent *e);
 static void unmapnotify(XEvent *e);
 
 /* general function declarations */
 static void focus(Client *c);
+static void statadd(int i, long long start, unsigned long req);
+static Client* wintoclient(Window w);
 
 /* variables */
-static char cmds[NUMCMDS][LENCMD], cmdfilter[LENCMD] = {'\0'}, stxt[256] = {
+static char *cmdnames = NULL, cmdfilter[LENCMD] = {'\0'}, stxt[256] = {
 	'f','i','l','e','t','-','w','m','\0',[255]='\0'};
+/* launcher command name offsets into the cmdnames arena (PATH order),
+   the commands sorted by name, the sorted position of each command,
+   and the stack of sorted ranges matching each length of the filter */
+static int *cmds = NULL, *cmdsort = NULL, *cmdrank = NULL, cmdslen = 0;
+static int cmdnameslen = 0, cmdlo[LENCMD], cmdhi[LENCMD];
 static int sw, sh;           /* X display screen geometry width, height */
+static int rrbase, monauto; /* XRandR event base, and monitor autodetection */
+static long long screenat = 0; /* when screen changes settle (see rrnotify) */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int tagset = 1; /* mask for which workspaces are displayed */
 /* The event handlers are organized in an array which is accessed
@@ -197,32 +279,105 @@ static void (*handler[LASTEvent]) (XEvent *) = { /* XEvent callbacks */
 	[ClientMessage] = clientmessage,
 	[ConfigureRequest] = configurerequest,
 	[DestroyNotify] = destroynotify,
+	[EnterNotify] = motionnotify,
 	[Expose] = expose,
+	[FocusIn] = focusin,
 	[GenericEvent] = exthandler,
 	[KeyPress] = keypress,
 	[MappingNotify] = grabkeys,
 	[MapRequest] = maprequest,
+	[MotionNotify] = motionnotify,
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify,
 };
+static const char *statnames[StatLast] = { /* names for dumpstats */
+	[0] = "extension", /* events beyond the core protocol */
+	[ButtonPress] = "buttonpress",
+	[ClientMessage] = "clientmessage",
+	[ConfigureRequest] = "configurerequest",
+	[DestroyNotify] = "destroynotify",
+	[EnterNotify] = "motionnotify", /* only tracks the pointer window */
+	[Expose] = "expose",
+	[FocusIn] = "focusin",
+	[GenericEvent] = "exthandler",
+	[KeyPress] = "keypress",
+	[MappingNotify] = "grabkeys",
+	[MapRequest] = "maprequest",
+	[MotionNotify] = "motionnotify",
+	[PropertyNotify] = "propertynotify",
+	[UnmapNotify] = "unmapnotify",
+	[StatArrange] = "arrange",
+	[StatRestack] = "restack",
+	[StatDrawbar] = "drawbar",
+	[StatMotion] = "motion",
+};
+static Stat stats[StatLast];      /* event handler and hot path statistics */
+static volatile sig_atomic_t dostats; /* dump the statistics (see sigstats) */
+static FILE *trace; /* event trace being recorded (see traceevent) */
 static Atom xatom[XAtomLast];     /* holds X types */
-static int end, domotion;         /* event loop helpers */
+static int end, domotion, doarrange, dorestack; /* event loop helpers */
+static int doclientlist;          /* publish the client list (see main) */
+static int restarting, restoring; /* session states (see restart) */
+static int unmanaging; /* defer arranging and restacking (see unmanage) */
+static Window *clientwins = NULL; /* client windows in the order managed */
+static int clientwinslen = 0, clientwinssize = 0;
 static Display *dpy;              /* X session display reference */
 static Drawable drawable;         /* canvas for drawing (bar) */
 static XftDraw *drawablexft;      /* font rendering for canvas */
 static GC gc;                     /* graphics context */
                                   /* references to managed windows */
 static Client *clients, *pinned = NULL, *sel;
+static Client *wins[WINSLEN];     /* window hash index of clients */
+static Client *freeclients = NULL; /* unused pooled clients (see newclient) */
+/* clients on the displayed workspaces, in client list order, rebuilt when
+   stale (see updatevis), and whether hidden clients could need moving
+   offscreen (see arrange) */
+static Client **vis = NULL;
+static int vislen = 0, visstale = 1, hidestale = 1;
+/* sorted distinct monitor edges, and the monitor covering each cell
+   between them, for point to monitor lookups (see monat) */
+static int *monxs = NULL, *monys = NULL, *moncells = NULL, monnx = 0, monny = 0;
+static MonLayout *monlay = NULL; /* layout state of each monitor */
+/* visible clients overlapping each cell of the hit grid, starting at the
+   cell's offset, rebuilt when stale (see hitclient) */
+static Client **hits = NULL;
+static int hitcell[HITN*HITN+1], hitstale = 1, barrank;
 static Window barwin, root, wmcheckwin, lastcw = {0};
 static int barfocus, barcmds, cmdi; /* bar status (force show / in launcher) */
+static int tagsw[32];             /* measured widths of the workspace tags */
+static unsigned int bartags = 0;  /* workspaces drawn on the bar (0: stale) */
+static int barfull = 1;           /* redraw and copy the whole bar */
 static int ctrlmode = CtrlNone; /* mouse mode (resize/repos/arrange/etc) */
+/* drag movement not yet applied, when the next drag frame is due, the
+   monitor refresh interval, and the dragged client's sync counter with
+   the value last requested and when, the value last reached, and the
+   alarm reporting it (see dragframe) */
+static int dragx, dragy, syncext, syncbase;
+static long long dragnext, framens = 1000000000LL / 60, dragval, dragsent;
+static long long dragdone;
+static XSyncCounter dragsync;
+static XSyncAlarm dragalarm = None;
+/* last known pointer position, movement since the last motion processing,
+   button state, and top level window under the pointer (see motionnotify),
+   the keyboard key states (see exthandler), and the pointer devices
+   moving relatively (see updatedevices) */
+static int ptrx, ptry, ptrdx, ptrdy, ptrsync;
+static unsigned int ptrmask;
+static Window ptrwin;
+static char keydown[32], ptrrel[32];
+/* keyboard shortcut for each keycode and modifier index, and the
+   keycodes of other keys, resolved when the mapping changes */
+static Key *keyacts[256][16];
+static KeyCode kcodes[KcLast];
 static Cursor curpoint, cursize;  /* mouse cursor icons */
 static XftColor cols[colslen];    /* colors (fg, bg, mark, bdr, selbdr) */
 static XftFont *xfont;            /* X font reference */
+static Provider *provs = NULL;    /* status text providers (see loadstatus) */
+static int provslen = 0;
+static struct pollfd *pfds;       /* X connection, then provider fds */
 /* dummy variables */
 static int di;
 static unsigned long dl;
-static unsigned int dui;
 static Window dwin;
 
 
@@ -244,7 +399,8 @@ static Window dwin;
 /* configurable values (see defaultconfig) */
 Monitor *mons;
 char *font, **colors, **tags, **startup, **terminal, **upvol, **downvol,
-	**mutevol, **suspend, **poweroff, **dimup, **dimdown, **help;
+	**mutevol, **suspend, **poweroff, **dimup, **dimdown, **help,
+	**statusplugins;
 int borderpx, snap, tagslen, monslen, keyslen, buttonslen;
 int *barpos;
 KeySym stackrelease, barshow;
@@ -266,7 +422,6 @@ void defaultconfig(void) {
 	   Set mons to the number of monitors you want supported.
 	   Initialise with {0} for autodetection of monitors,
 	   otherwise set the position and size ({x,y,w,h}).
-	   !!!Warning!!! maximum of 32 monitors supported.
 	   e.g:
 	A(Monitor, mons, {
 		{2420, 0, 1020, 1080},
@@ -304,6 +459,12 @@ void defaultconfig(void) {
 	P(char*, dimdown, {CMD(DIMCMD("-dec"))});
 	/* the startup command is run when filetwm opens */
 	P(char*, startup, {CMD(TRY(filetstatus,)"$(dirname $FILETWM)/filetstatus")});
+	/* status text provider plugins (paths relative to the home directory),
+	   replacing the root window name as the status text when any are given
+	   (see loadstatus), e.g:
+	P(char*, statusplugins, {".config/filetwmstatus.so", NULL});
+	*/
+	P(char*, statusplugins, {NULL});
 
 	/* keyboard shortcut definitions */
 	#define AltMask Mod1Mask
@@ -337,6 +498,7 @@ void defaultconfig(void) {
 		{   WinMask|ShiftMask, XK_Right, viewtagshift, {.i = +1 } },
 		{                 WinMask, XK_0, tag, {.ui = ~0 } },
 		{ WinMask|ControlMask|ShiftMask, XK_F4, quit, {0} },
+		{    WinMask|ControlMask, XK_F4, restart, {0} },
 		{                WinMask, XK_F4, killclient, {0} },
 		{      WinMask|ShiftMask, XK_F4, spawn, {.v = &suspend } },
 		{    0, XF86XK_AudioLowerVolume, spawn, {.v = &downvol } },
@@ -370,7 +532,7 @@ void defaultconfig(void) {
 
 /**
  * Add a client into the the list after another client
- * or at the top.
+ * or at the top, and index it by its window.
  * @c: Client* - a pointer to the client to add to the list.
  * @after: Client* - a pointer to the client to place the
  *         window after. NULL adds to the top of the list.
@@ -378,6 +540,39 @@ void defaultconfig(void) {
 void attach(Client *c, Client *after) {
 	c->next = after? after->next : clients;
 	*(after? &after->next : &clients) = c;
+	c->hnext = wins[WINHASH(c->win)];
+	wins[WINHASH(c->win)] = c;
+	hitstale = visstale = 1;
+}
+
+
+/**
+ * Add a command to the launcher's commands, copying the name
+ * into the cmdnames arena and growing the storage as needed.
+ * @name: the command name (not necessarily null terminated).
+ * @len: the length of the name.
+ */
+void addcmd(const char *name, int len) {
+	static int namessize = 0, cmdssize = 0;
+
+	if (cmdnameslen + len + 1 > namessize && !(cmdnames = realloc(cmdnames,
+		namessize = 2 * (cmdnameslen + len + 1))))
+		DIE("realloc failed.\n");
+	if (cmdslen == cmdssize && !(cmds = realloc(cmds,
+		(cmdssize = 2 * cmdslen + 256) * sizeof(int))))
+		DIE("realloc failed.\n");
+	memcpy(&cmdnames[cmdnameslen], name, len);
+	cmdnames[cmdnameslen + len] = '\0';
+	cmds[cmdslen++] = cmdnameslen;
+	cmdnameslen += len + 1;
+}
+
+
+/**
+ * Compare launcher commands by name, given their indices (see qsort).
+ */
+int cmdcmp(const void *a, const void *b) {
+	return strcmp(CMDNAME(*(int *)a), CMDNAME(*(int *)b));
 }
 
 
@@ -403,28 +598,214 @@ void configure(Client *c) {
 
 
 /**
- * Remove a specific client from the list.
+ * Remove a specific client from the list and the window index.
  */
 void detach(Client *c) {
 	Client **tc;
 	for (tc = &clients; *tc && *tc != c; tc = &(*tc)->next);
 	*tc = c->next;
+	for (tc = &wins[WINHASH(c->win)]; *tc && *tc != c; tc = &(*tc)->hnext);
+	*tc = c->hnext;
+	hitstale = visstale = 1;
+}
+
+
+/**
+ * Find the cell between sorted distinct edges holding a position.
+ * Returns the index of the cell's lower edge, or -1 if the position
+ * is outside the edges.
+ * @e: int* - the sorted edges.
+ * @n: int - number of edges.
+ * @v: int - the position.
+ */
+int edgecell(const int *e, int n, int v) {
+	int lo = 0, hi = n - 1, i;
+
+	if (n < 2 || v < e[0] || v >= e[n-1]) return -1;
+	/* find the last edge at or before the position */
+	while (hi - lo > 1)
+		if (e[(i = (lo + hi) / 2)] <= v) lo = i;
+		else hi = i;
+	return lo;
+}
+
+
+/**
+ * Returns the path to execute the given command from, searching
+ * PATH (as execlp would) unless it already names a path,
+ * or NULL if there is no executable for it.
+ */
+const char *execpath(const char *cmd) {
+	static char file[4096];
+	const char *path = getenv("PATH");
+	int i, s;
+
+	if (strchr(cmd, '/')) return access(cmd, X_OK) ? NULL : cmd;
+	for (i = 0; path && i < strlen(path); i += s + 1) {
+		/* empty entries are the current directory */
+		s = strcspn(&path[i], ":");
+		if (snprintf(file, sizeof file, "%.*s/%s", s ? s : 1, s ? &path[i] : ".",
+			cmd) < sizeof file && !access(file, X_OK))
+			return file;
+	}
+	return NULL;
 }
 
 
 /**
- * Query the X server for a window property.
+ * Narrow the launcher's range of matching commands for each
+ * length of the filter past the given length, searching only
+ * within the range of the shorter filter. Ranges for shorter
+ * filters are kept for restoring on backspace.
+ * @from: the filter length with an already narrowed range.
  */
-Atom getatomprop(Client *c, Atom prop) {
+void filtercmds(int from) {
+	int l, lo, hi, mid;
+
+	for (l = from + 1; l <= strlen(cmdfilter); l++) {
+		/* find the first command at or after the filter */
+		for (lo = cmdlo[l-1], hi = cmdhi[l-1]; lo < hi;)
+			if (strncmp(CMDNAME(cmdsort[mid = (lo+hi)/2]), cmdfilter, l) < 0)
+				lo = mid+1;
+			else hi = mid;
+		cmdlo[l] = lo;
+		/* find the first command after the filter */
+		for (hi = cmdhi[l-1]; lo < hi;)
+			if (strncmp(CMDNAME(cmdsort[mid = (lo+hi)/2]), cmdfilter, l) <= 0)
+				lo = mid+1;
+			else hi = mid;
+		cmdhi[l] = lo;
+	}
+}
+
+
+/**
+ * Return a client to the pool for reuse (see newclient).
+ */
+void freeclient(Client *c) {
+	c->next = freeclients;
+	freeclients = c;
+}
+
+
+/**
+ * Query the X server for the first value of a window property.
+ * @prop: the property to query.
+ * @type: the type of the property (such as XA_ATOM).
+ */
+long getprop(Client *c, Atom prop, Atom type) {
 	unsigned char *p = NULL;
-	Atom da, atom = None;
+	Atom da;
+	long v = None;
 
-	if (XGetWindowProperty(dpy, c->win, prop, 0L, sizeof atom, False, XA_ATOM,
+	if (XGetWindowProperty(dpy, c->win, prop, 0L, 1L, False, type,
 		&da, &di, &dl, &dl, &p) == Success && p) {
-		atom = *(Atom *)p;
+		v = *(long *)p;
 		XFree(p);
 	}
-	return atom;
+	return v;
+}
+
+
+/**
+ * Find the top visible client whose window, or the edge zone
+ * around it, is at the given screen position, without asking
+ * the server. Only the clients overlapping the grid cell of the
+ * position are checked, and the grid is rebuilt when window
+ * geometry or visibility has changed since it was last built.
+ * Returns NULL if no client is there, or the bar is above.
+ * @x: the horizontal screen position.
+ * @y: the vertical screen position.
+ */
+Client* hitclient(int x, int y) {
+	static int hitssize = 0;
+	int i, j, k, n;
+	Client *c, *top = NULL;
+
+	#define HITSPAN(C) for (j = MAX(0, (C->y - C->bw) * HITN / sh);\
+		j <= MIN(HITN-1, (C->y + HEIGHT(C) + C->bw) * HITN / sh); j++)\
+		for (i = MAX(0, (C->x - C->bw) * HITN / sw);\
+			i <= MIN(HITN-1, (C->x + WIDTH(C) + C->bw) * HITN / sw); i++)
+	if (hitstale) {
+		/* count the visible clients in each cell (offset by one) */
+		memset(hitcell, 0, sizeof hitcell);
+		for (n = 0, c = clients; c; c = c->next)
+			if (ISVISIBLE(c)) HITSPAN(c) {
+				hitcell[j*HITN+i+1]++;
+				n++;
+			}
+		if (n > hitssize && !(hits = realloc(hits,
+			(hitssize = 2 * n) * sizeof(Client *))))
+			DIE("realloc failed.\n");
+		/* fill each cell from its offset, leaving the offsets at the cell
+		   ends, then shift them back to the starts */
+		for (k = 1; k <= HITN*HITN; k++) hitcell[k] += hitcell[k-1];
+		for (c = clients; c; c = c->next)
+			if (ISVISIBLE(c)) HITSPAN(c) hits[hitcell[j*HITN+i]++] = c;
+		memmove(&hitcell[1], &hitcell[0], HITN*HITN * sizeof(int));
+		hitcell[0] = hitstale = 0;
+	}
+
+	/* find the highest stacked client in the cell */
+	k = HITCELL(x, y);
+	for (i = hitcell[k]; i < hitcell[k+1]; i++)
+		if (ISVISIBLE(hits[i]) && INZONE(hits[i], x, y)
+		&& (!top || hits[i]->rank > top->rank))
+			top = hits[i];
+	/* the bar could be above */
+	if (top && top->rank < barrank && x >= barpos[0] && y >= barpos[1]
+	&& x < barpos[0] + barpos[2] && y < barpos[1] + BARH)
+		return NULL;
+	return top;
+}
+
+
+/**
+ * Returns the index of the monitor holding the given point,
+ * from the monitor index (see updatemonindex). Where monitors
+ * overlap, the last one configured holds the point, or the first
+ * one (as edge snapping and fullscreen spreading look them up).
+ * @def: int - the index returned if no monitor holds the point.
+ * @first: int(bool) - if true, pick the first overlapping monitor.
+ */
+int monat(int x, int y, int def, int first) {
+	int i = edgecell(monxs, monnx, x), j = edgecell(monys, monny, y);
+
+	if (i < 0 || j < 0) return def;
+	j += i*(monny-1) + (first ? (monnx-1)*(monny-1) : 0);
+	return moncells[j] < 0 ? def : moncells[j];
+}
+
+
+/**
+ * Take a zeroed client from the pool, allocating a new slab of
+ * clients when the pool is empty. Slabs are kept for reuse, which keeps
+ * clients dense in memory and avoids heap churn as windows come and go.
+ */
+Client* newclient(void) {
+	Client *c;
+	int i;
+
+	if (!freeclients) {
+		if (!(c = calloc(CLIENTSLAB, sizeof(Client))))
+			DIE("calloc failed.\n");
+		for (i = CLIENTSLAB-1; i >= 0; i--)
+			freeclient(&c[i]);
+	}
+	c = freeclients;
+	freeclients = c->next;
+	memset(c, 0, sizeof(Client));
+	return c;
+}
+
+
+/**
+ * Read the monotonic clock in nanoseconds.
+ */
+long long nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 
@@ -463,8 +844,8 @@ void resize(Client *c, int x, int y, int w, int h, int active) {
 	/* snap edges for floating windows */
 	if (!c->tile && !c->full) {
 		/* find monitor so as to snap position to edges */
-		for (m1 = 0; m1 < monslen-1 && !INMON(x+snap, y+snap, mons[m1]); m1++);
-		for (m2 = 0; m2 < monslen-1 && !INMON(x+w-snap, y+h-snap, mons[m2]); m2++);
+		m1 = monat(x+snap, y+snap, monslen-1, 1);
+		m2 = monat(x+w-snap, y+h-snap, monslen-1, 1);
 		/* snap position */
 		x = (abs(mons[m1].mx - x) < snap) ? mons[m1].mx : x;
 		y = (abs(mons[m1].my - y) < snap) ? mons[m1].my : y;
@@ -494,14 +875,17 @@ void resize(Client *c, int x, int y, int w, int h, int active) {
 
 	/* apply the resize if anything ended up changing */
 	if (x != c->x || y != c->y || w != c->w || h != c->h) {
-		c->x = wc.x = x;
-		c->y = wc.y = y;
+		c->x = c->sx = wc.x = x;
+		c->y = c->sy = wc.y = y;
 		c->w = wc.width = w;
 		c->h = wc.height = h;
 		/* fullscreen changes update the border width */
 		wc.border_width = c->bw;
 		XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 		configure(c);
+		hitstale = 1;
+		/* hidden windows need moving back offscreen (see arrange) */
+		hidestale |= !ISVISIBLE(c);
 	}
 }
 
@@ -519,14 +903,26 @@ void resize(Client *c, int x, int y, int w, int h, int active) {
  *  - CliRemove: Remove window from stack entirely.
  *  - BarShow: Raise bar (c ignored).
  *  - BarHide: Drop bar to its normal stack order (c ignored).
+ * The window last stacked above each window is remembered so
+ * only windows whose place in the stack changed are restacked,
+ * keeping the remembered windows in step with each restacking.
+ * While the event queue is busy, applying the stacking to the
+ * windows is deferred until the queue is clear (see main).
  */
 void restack(Client *c, int mode) {
-	static Client *allraised[32] = {0}; /* raised window over all workspaces */
-	Client **raised = &allraised[0];
-	int barup, i = 0, j;
-	Window topstack[4] = {0};
+	static Client **allraised = NULL; /* raised window of each workspace */
+	static Window *stack = NULL, barsib = None; /* stack order, back to front */
+	static Window **sibs = NULL; /* remembered window above each in stack */
+	static int stacklen = 0, laststackn = 0;
+	Client **raised, *front;
+	int barup, pinup, changed, i, j, n;
+	long long start;
+	unsigned long req;
+	Window old;
 	XWindowChanges wc;
 
+	if (!allraised && !(allraised = calloc(tagslen + 1, sizeof(Client *))))
+		DIE("calloc failed.\n");
 	switch (mode) {
 	case CliPin:
 		/* toggle pinned state */
@@ -558,63 +954,118 @@ void restack(Client *c, int mode) {
 	raised = &allraised[j];
 	if (mode == CliZoom || mode == CliRaise)
 		focus(c ? (*raised = c) : *raised);
-
-	/* start window stacking */
+	if ((dorestack = XQLength(dpy) > 0 || unmanaging)) return;
+	start = nsnow();
+	req = NextRequest(dpy);
+
+	/* build the stack order, filling from the front (end of the array) */
+	for (n = 1, c = clients; c; c = c->next, n++); /* clients and the bar */
+	if (n > stacklen && (!(stack = realloc(stack, 2*n * sizeof(Window)))
+	|| !(sibs = realloc(sibs, (stacklen = 2*n) * sizeof(Window *)))))
+		DIE("realloc failed.\n");
+	i = n;
 	/* bar window is above all when bar is focused,
 	   or under selected pinned or selected raised window.
-	   pinned window is always above raised. */
-	XDeleteProperty(dpy, root, xatom[NetCliStack]);
-	barup = barfocus || (pinned != sel && *raised != sel);
-	if (barup) topstack[i++] = barwin;
-	if (pinned) {
-		topstack[i++] = pinned->win;
-		PROPADD(Prepend, root, NetCliStack, XA_WINDOW, 32, &pinned->win, 1);
-	}
-	if (*raised) {
-		topstack[i++] = (*raised)->win;
-		PROPADD(Prepend, root, NetCliStack, XA_WINDOW, 32, &(*raised)->win, 1);
-	}
-	if (!barup) topstack[i++] = barwin;
-	XRaiseWindow(dpy, (wc.sibling = topstack[0]));
-	wc.stack_mode = Below;
-	for (i = 1; i < 4 && topstack[i]; i++) {
-		XConfigureWindow(dpy, topstack[i], CWSibling|CWStackMode, &wc);
-		wc.sibling = topstack[i];
-	}
-
+	   pinned window is always above raised, except a raised fullscreen
+	   window is kept in front of the bar and pinned window where it
+	   covers them, unless they are focused, so nothing overlaps it
+	   and compositors can unredirect it. */
+	front = *raised && (*raised)->full && (*raised)->bypass != 2 ? *raised : NULL;
+	barup = barfocus || (pinned != sel && *raised != sel
+		&& !(front && OVERLAP(front, barpos[0], barpos[1], barpos[2], BARH)));
+	pinup = pinned && (pinned == sel || !front
+		|| !OVERLAP(front, pinned->x, pinned->y, WIDTH(pinned), HEIGHT(pinned)));
+	if (barup) stack[--i] = barwin;
+	if (pinup) stack[--i] = pinned->win;
+	if (*raised && *raised != pinned) stack[--i] = (*raised)->win;
+	if (pinned && !pinup) stack[--i] = pinned->win;
+	if (!barup) stack[--i] = barwin;
 	/* show windows in the standard layers */
 	/* order layers - floating then tiled then fullscreen (if not raised) */
 	/* 0=floating 1=tiled 2=fullscreen */
 	for (int l = 0; l < 3; l++)
 		for (c = clients; c; c = c->next)
-			if (c != pinned && c != *raised && (c->full?2:c->tile?1:0) == l) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
-				PROPADD(Prepend, root, NetCliStack, XA_WINDOW, 32, &c->win, 1);
-				wc.sibling = c->win;
-			}
+			if (c != pinned && c != *raised && (c->full?2:c->tile?1:0) == l)
+				stack[--i] = c->win;
+
+	/* remember the stack position for hit testing (see hitclient) */
+	for (i = 0; i < n; i++)
+		if (stack[i] == barwin) {
+			barrank = i;
+			sibs[i] = &barsib;
+		} else {
+			sibs[i] = &(c = wintoclient(stack[i]))->sib;
+			c->rank = i;
+		}
+
+	/* apply the stacking from the front, skipping windows already in place */
+	XRaiseWindow(dpy, stack[n-1]);
+	wc.stack_mode = Below;
+	for (changed = n != laststackn, i = n-1; i >= 0; i--) {
+		wc.sibling = i < n-1 ? stack[i+1] : None;
+		if ((old = *sibs[i]) == wc.sibling) continue;
+		changed = 1;
+		*sibs[i] = wc.sibling;
+		if (wc.sibling)
+			XConfigureWindow(dpy, stack[i], CWSibling|CWStackMode, &wc);
+		/* the window that was under it is now under its old sibling,
+		   and the window that was under its new sibling is now under it
+		   (only windows further back can be either) */
+		for (j = 0; j < i; j++)
+			if (*sibs[j] == stack[i])
+				*sibs[j] = old;
+			else if (*sibs[j] == wc.sibling && wc.sibling)
+				*sibs[j] = stack[i];
+	}
+	laststackn = n;
+
+	/* publish the client stack (without the bar) if the order changed */
+	if (changed) {
+		for (i = 0; stack[i] != barwin; i++);
+		memmove(&stack[i], &stack[i+1], (n-i-1) * sizeof(Window));
+		PROPSET(root, NetCliStack, XA_WINDOW, 32, stack, n-1);
+	}
+	statadd(StatRestack, start, req);
 }
 
 
 /**
- * Send a message to a cliant via the XServer.
+ * Event predicate matching configure requests for the
+ * given window (see XCheckIfEvent).
  */
-int sendevent(const Client *c, Atom proto) {
-	int n;
-	Atom *protocols;
-	int exists = 0;
+Bool samecfgevent(Display *dpy, XEvent *e, XPointer arg) {
+	return e->type == ConfigureRequest
+		&& e->xconfigurerequest.window == *(Window *)arg;
+}
+
+
+/**
+ * Event predicate matching property events for the same window
+ * and property as the given event (see XCheckIfEvent).
+ */
+Bool samepropevent(Display *dpy, XEvent *e, XPointer arg) {
+	XPropertyEvent *p = &((XEvent *)arg)->xproperty;
+	return e->type == PropertyNotify && e->xproperty.window == p->window
+		&& e->xproperty.atom == p->atom;
+}
+
+
+/**
+ * Send a message to a cliant via the XServer, if the client supports
+ * the protocol. Supported protocols are known without a round trip
+ * (see updateprotocols).
+ * @proto: int - the atom index of the protocol (e.g. WMDelete).
+ */
+int sendevent(const Client *c, int proto) {
+	int exists = c->protos & 1 << proto;
 	XEvent ev;
 
-	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
-		while (!exists && n--)
-			exists = protocols[n] == proto;
-		XFree(protocols);
-	}
 	if (exists) {
 		ev.type = ClientMessage;
 		ev.xclient.window = c->win;
 		ev.xclient.message_type = xatom[WMProtocols];
 		ev.xclient.format = 32;
-		ev.xclient.data.l[0] = proto;
+		ev.xclient.data.l[0] = xatom[proto];
 		ev.xclient.data.l[1] = CurrentTime;
 		XSendEvent(dpy, c->win, False, NoEventMask, &ev);
 	}
@@ -636,18 +1087,103 @@ void sigchld(int unused) {
 }
 
 
+/**
+ * Signal handler that requests the statistics are dumped
+ * (see dumpstats). This is done by the event loop, once the
+ * signal interrupts its waiting, or after the event being handled.
+ */
+void sigstats(int sig) {
+	/* self-register this method as the SIGUSR1 handler (if haven't already) */
+	if (signal(SIGUSR1, sigstats) == SIG_ERR)
+		DIE("can't install SIGUSR1 handler.\n");
+	dostats = sig == SIGUSR1;
+}
+
+
+/**
+ * Record a call for the statistics (see dumpstats).
+ * @i: the statistics slot (an event type or a Stat* value).
+ * @start: the time the call started (see nsnow).
+ * @req: the X request number when the call started (see NextRequest).
+ */
+void statadd(int i, long long start, unsigned long req) {
+	long long ns = nsnow() - start;
+	stats[i].count++;
+	stats[i].reqs += NextRequest(dpy) - req;
+	stats[i].ns += ns;
+	stats[i].maxns = MAX(stats[i].maxns, ns);
+}
+
+
+/**
+ * Record an event taken from the queue to the event trace, if one is
+ * being recorded (the FILETWMTRACE environment variable is set), along
+ * with the number of events queued behind it, so the event stream
+ * can be replayed to benchmark the handlers (see filetreplay.c).
+ * Records are flushed whenever the queue is clear, before waiting.
+ */
+void traceevent(XEvent *e) {
+	static long long start = 0;
+	Trace t = {.ev = *e, .qlen = XQLength(dpy)};
+	int i;
+
+	if (!trace) return;
+	if (!start) {
+		start = nsnow();
+		fwrite(&(Trace){.qlen = -1, .ev.xclient = {.window = root,
+			.data.l = {barwin}}}, sizeof(Trace), 1, trace);
+		/* the clients managed before the trace, in the order managed */
+		for (i = 0; i < clientwinslen; i++)
+			if (wintoclient(clientwins[i]))
+				fwrite(&(Trace){.qlen = -2, .ev.xmaprequest = {.type = MapRequest,
+					.parent = root, .window = clientwins[i]}}, sizeof(Trace), 1, trace);
+	}
+	t.ns = nsnow() - start;
+	/* the extension data of cookies isn't kept */
+	if (t.ev.type == GenericEvent) {
+		t.ev.xcookie.cookie = 0;
+		t.ev.xcookie.data = NULL;
+	}
+	fwrite(&t, sizeof(Trace), 1, trace);
+	if (!t.qlen) fflush(trace);
+}
+
+
+/**
+ * Record which of the WM_PROTOCOLS used by filetwm a client supports,
+ * so messages can be sent without querying first (see sendevent).
+ * @protos: already retrieved protocols, or NULL to query the X server.
+ * @n: the number of protocols retrieved.
+ */
+void updateprotocols(Client *c, const Atom *protos, int n) {
+	static const int used[] = {WMDelete, WMTakeFocus, NetWMSyncRequest};
+	Atom *p = NULL;
+	int i;
+
+	if (!protos && XGetWMProtocols(dpy, c->win, &p, &n))
+		protos = p;
+	for (c->protos = 0; protos && n--;)
+		for (i = 0; i < sizeof used / sizeof *used; i++)
+			if (protos[n] == xatom[used[i]])
+				c->protos |= 1 << used[i];
+	if (p) XFree(p);
+}
+
+
 /**
  * Retrieve size hint information for a client.
  * Stores the sizing information for the client
  * for future layout operations.
+ * @hints: already retrieved size hints, or NULL to query the X server.
  */
-void updatesizehints(Client *c) {
+void updatesizehints(Client *c, XSizeHints *hints) {
 	long msize;
 	XSizeHints size;
 
 	c->basew = c->baseh = c->maxw = c->maxh = c->minw = c->minh = 0;
 	c->maxa = c->mina = 0.0;
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize)) return;
+	if (hints) size = *hints;
+	else if (!XGetWMNormalHints(dpy, c->win, &size, &msize)) return;
 
 	if (size.flags & PBaseSize) {
 		c->basew = c->minw = size.base_width;
@@ -668,13 +1204,34 @@ void updatesizehints(Client *c) {
 }
 
 
+/**
+ * Rebuild the list of clients on the displayed workspaces, if the
+ * client list, the client workspaces, or the displayed workspaces
+ * changed since it was last built.
+ */
+void updatevis(void) {
+	static int vissize = 0;
+	Client *c;
+
+	if (!visstale) return;
+	for (vislen = 0, c = clients; c; c = c->next) {
+		if (vislen == vissize && !(vis = realloc(vis,
+			(vissize = 2 * vislen + 64) * sizeof(Client *))))
+			DIE("realloc failed.\n");
+		if (ISVISIBLE(c)) vis[vislen++] = c;
+	}
+	visstale = 0;
+}
+
+
 /**
  * Returns a pointer to the client which manages the given X window,
  * or NULL if the given X window is not a managed client.
+ * This only searches the window's hash bucket.
  */
 Client* wintoclient(Window w) {
 	Client *c;
-	for (c = clients; c && c->win != w; c = c->next);
+	for (c = wins[WINHASH(w)]; c && c->win != w; c = c->hnext);
 	return c;
 }
 
@@ -724,78 +1281,100 @@ int xerror(Display *dpy, XErrorEvent *ee) {
  *          layer with another location or size.
  * @drop: int(bool) - if true, move the active window into
  *        its new position in the stack and clear the remaining column.
+ * While the event queue is busy, rearranging without an active window
+ * is deferred until the queue is clear (see main).
  */
 void arrange(Client *active, int drop) {
 	Client *c;
-	/* maximum of 32 monitors supported */
-	int m, rm;
-	int w[32]={0}, h[32]={0}, nw[32]={0}, nh[32], x[32]={0}, y[32]={0}, s[32];
+	int i, m;
+	long long start;
+	unsigned long req;
 
 	/* ensure a visible window has focus */
 	focus(NULL);
-
-	/* hide and show clients for the current workspace */
-	for (c = clients; c; c = c->next)
-		XMoveWindow(dpy, c->win, ISVISIBLE(c) ? c->x : WIDTH(c) * -2, c->y);
-
-	/* evaluate the number of columns per monitor */
-	for (c = clients; c; c = c->next)
-		if (c->tile && !c->full && ISVISIBLE(c)) {
-			for (m = monslen-1; m > 0 && !ONMON(c, mons[m]); m--); /* find monitor */
-			/* increment the column count ensuring the first column leader */
-			nw[m] += !(c->chain = c->chain && nw[m]);
+	if (!active && (XQLength(dpy) > 0 || unmanaging)) {
+		doarrange = 1;
+		return;
+	}
+	if (!active) doarrange = 0;
+	start = nsnow();
+	req = NextRequest(dpy);
+
+	/* reset the layout state of each monitor */
+	memset(monlay, 0, monslen * sizeof(MonLayout));
+
+	/* hide and show clients for the current workspace,
+	   only moving windows that aren't already in place, and only
+	   checking hidden clients when they could have changed */
+	for (c = hidestale ? clients : NULL; c; c = c->next)
+		if (!ISVISIBLE(c) && (WIDTH(c) * -2 != c->sx || c->y != c->sy)) {
+			XMoveWindow(dpy, c->win, (c->sx = WIDTH(c) * -2), (c->sy = c->y));
+			hitstale = 1;
 		}
+	hidestale = 0;
+	for (updatevis(), i = 0; i < vislen; i++) {
+		c = vis[i];
+		if (c->x != c->sx || c->y != c->sy) {
+			XMoveWindow(dpy, c->win, (c->sx = c->x), (c->sy = c->y));
+			hitstale = 1;
+		}
+		if (!c->tile || c->full) continue;
+		/* find the monitor placement */
+		c->mon = m = ONMON(c);
+		/* count the columns per monitor, ensuring the first column leader,
+		   and count the rows of each column on its leader */
+		if ((c->chain = c->chain && monlay[m].nw))
+			monlay[m].lead->rows++;
+		else {
+			monlay[m].nw++;
+			(monlay[m].lead = c)->rows = 1;
+		}
+	}
 
 	/* orient columns horizontally for vertical monitors */
 	#define ORIENT(C, R) (mons[m].mw > mons[m].mh ? C : R)
-	#define X ORIENT(x, y)
-	#define Y ORIENT(y, x)
-	#define W ORIENT(w, h)
-	#define H ORIENT(h, w)
+	#define X (*ORIENT(&monlay[m].x, &monlay[m].y))
+	#define Y (*ORIENT(&monlay[m].y, &monlay[m].x))
+	#define W (*ORIENT(&monlay[m].w, &monlay[m].h))
+	#define H (*ORIENT(&monlay[m].h, &monlay[m].w))
 	#define MW ORIENT(mons[m].mw, mons[m].mh)
 	#define MH ORIENT(mons[m].mh, mons[m].mw)
-	#define INCOL(C) (ORIENT(C->x,C->y) > X[m] && ORIENT(C->x,C->y) < X[m]+W[m])
-	#define INROW(C) (ORIENT(C->y,C->x) > Y[m] && ORIENT(C->y,C->x) < Y[m]+H[m])
-	#define SMH (active && INCOL(active) ? MH-s[m] : MH)
+	#define INCOL(C) (ORIENT(C->x,C->y) > X && ORIENT(C->x,C->y) < X+W)
+	#define INROW(C) (ORIENT(C->y,C->x) > Y && ORIENT(C->y,C->x) < Y+H)
+	#define SMH (active && INCOL(active) ? MH-monlay[m].s : MH)
 
 	/* tile all the relevant clients */
-	for (c = clients; c; c = c->next) {
-		if (!c->tile || c->full || !ISVISIBLE(c)) continue;
-		/* find the monitor placement */
-		for (m = monslen-1; m > 0 && !ONMON(c, mons[m]); m--);
+	for (i = 0; i < vislen; i++) {
+		c = vis[i];
+		if (!c->tile || c->full) continue;
+		m = c->mon;
 
 		/* arrange columns from the left */
 		if (!c->chain) {
-			X[m] += W[m];
-			W[m] = MW-X[m]-ORIENT(c->fw, c->fh) <= MW/50*nw[m] ? (MW-X[m])/nw[m] : \
-				nw[m]>1? ORIENT(c->fw, c->fh) : MW-X[m]; /* fitted tile width */
-			nw[m]--;
+			X += W;
+			W = MW-X-ORIENT(c->fw, c->fh) <= MW/50*monlay[m].nw ? (MW-X)/monlay[m].nw : \
+				monlay[m].nw>1? ORIENT(c->fw, c->fh) : MW-X; /* fitted tile width */
+			monlay[m].nw--;
 
-			/* reset at column leader and find the number of rows */
-			Y[m] = H[m] = 0;
+			/* reset at column leader with its number of rows */
+			Y = H = 0;
 			/* the roaming active window reserves a 25th of the screen in the
 				 destination position.*/
-			s[m] = MH / 25;
-			nh[m] = 1;
-			for (Client *r = c->next; r; r = r->next)
-				if (r->tile && !r->full && ISVISIBLE(r)) {
-					for (rm = monslen-1; rm > 0 && !ONMON(r, mons[rm]); rm--);
-					if (rm == m && !r->chain) break;
-					if (rm == m) nh[m]++; /* increment the row count */
-				}
+			monlay[m].s = MH / 25;
+			monlay[m].nh = c->rows;
 		}
 
 		/* stack rows from the top */
-		Y[m] += H[m];
+		Y += H;
 		/* height of the tile, shrunk to make space for a roaming active window */
-		H[m] = SMH-Y[m]-ORIENT(c->fh, c->fw) <= SMH/50*nh[m] ? (SMH-Y[m])/nh[m] : \
-			nh[m]>1? ORIENT(c->fh, c->fw) : SMH-Y[m]; /* fitted tile height */
-		nh[m]--;
+		H = SMH-Y-ORIENT(c->fh, c->fw) <= SMH/50*monlay[m].nh ? (SMH-Y)/monlay[m].nh : \
+			monlay[m].nh>1? ORIENT(c->fh, c->fw) : SMH-Y; /* fitted tile height */
+		monlay[m].nh--;
 
 		/* place the client into the tile position */
 		if (c != active)
-			resize(c, mons[m].mx+x[m], mons[m].my+y[m],
-				w[m]-2*c->bw, h[m]-2*c->bw, 0);
+			resize(c, mons[m].mx+monlay[m].x, mons[m].my+monlay[m].y,
+				monlay[m].w-2*c->bw, monlay[m].h-2*c->bw, 0);
 
 		/* drop the active window into the new position and arrange again,
 			 or just leave some room for the active window being dragged */
@@ -806,10 +1385,11 @@ void arrange(Client *active, int drop) {
 				detach(active);
 				attach(active, c);
 				arrange(NULL, 0);
+				statadd(StatArrange, start, req);
 				return;
 			} else {
-				Y[m] += s[m];
-				s[m] = 0;
+				Y += monlay[m].s;
+				monlay[m].s = 0;
 			}
 		}
 	}
@@ -821,6 +1401,72 @@ void arrange(Client *active, int drop) {
 		active->chain = 0;
 		arrange(NULL, 0);
 	}
+	statadd(StatArrange, start, req);
+}
+
+
+/**
+ * Apply the pending drag movement to the selected window, at most
+ * once per monitor refresh (see updaterate), so heavy clients aren't
+ * configured faster than they can be shown. Clients supporting
+ * _NET_WM_SYNC_REQUEST are also given until they have repainted
+ * (or a few frames pass) before they are configured again.
+ * Returns the milliseconds until the drag should be tried again,
+ * or -1 if there is no drag movement waiting.
+ */
+int dragframe(void) {
+	int x = dragx, y = dragy, fx, fy, fw, fh;
+	long long now = nsnow();
+	XSyncAlarmAttributes a;
+	XEvent ev;
+
+	if ((!x && !y) || !sel || (ctrlmode != DragMove && ctrlmode != DragSize))
+		return -1;
+	if (now < dragnext)
+		return (dragnext - now) / 1000000 + 1;
+	/* wait for the client's counter to reach the last request,
+	   which is reported by the alarm (see syncnotify) */
+	if (dragsync && now < dragsent + 4 * framens && dragdone < dragval)
+		return (dragsent + 4 * framens - now) / 1000000 + 1;
+	dragx = dragy = 0;
+	dragnext = now + framens;
+
+	/* request the client to update its counter after the configure */
+	if (dragsync) {
+		ev.type = ClientMessage;
+		ev.xclient.window = sel->win;
+		ev.xclient.message_type = xatom[WMProtocols];
+		ev.xclient.format = 32;
+		ev.xclient.data.l[0] = xatom[NetWMSyncRequest];
+		ev.xclient.data.l[1] = CurrentTime;
+		ev.xclient.data.l[2] = ++dragval & 0xffffffff;
+		ev.xclient.data.l[3] = dragval >> 32;
+		XSendEvent(dpy, sel->win, False, NoEventMask, &ev);
+		/* have the alarm report when the counter reaches the request */
+		a.trigger.counter = dragsync;
+		a.trigger.value_type = XSyncAbsolute;
+		a.trigger.test_type = XSyncPositiveComparison;
+		XSyncIntsToValue(&a.trigger.wait_value, dragval & 0xffffffff, dragval >> 32);
+		a.events = True;
+		if (dragalarm)
+			XSyncChangeAlarm(dpy, dragalarm, XSyncCACounter|XSyncCAValueType
+				|XSyncCATestType|XSyncCAValue|XSyncCAEvents, &a);
+		else dragalarm = XSyncCreateAlarm(dpy, XSyncCACounter|XSyncCAValueType
+			|XSyncCATestType|XSyncCAValue|XSyncCAEvents, &a);
+	}
+	#define WV(V) (sel->tile ? sel->V : sel->f##V)
+	fx = sel->x; fy = sel->y; fw = sel->w; fh = sel->h;
+	if (ctrlmode == DragMove)
+		resize(sel, WV(x)+x, WV(y)+y, WV(w), WV(h), 1);
+	if (ctrlmode == DragSize)
+		resize(sel, WV(x), WV(y), WV(w)+x, WV(h)+y, 1);
+	/* only wait for a repaint if the window was configured */
+	dragsent = fx != sel->x || fy != sel->y || fw != sel->w || fh != sel->h
+		? now : 0;
+	/* update the monitor layout to match any tiling changes */
+	if (sel->tile)
+		arrange(sel, 0);
+	return -1;
 }
 
 
@@ -839,51 +1485,107 @@ int drawntextwidth(const char *text) {
  * Render the given text onto the bar's drawable with
  * a given position and background color.
  * @x: the horizontal position to start writing.
+ * @w: the width of the drawn text (see TEXTW).
  * @text: the text to write.
  * @bg: the background color to use.
  * Returns the horizontal position at the end of the writing.
  */
-int drawbartext(int x, const char *text, const XftColor *bg) {
+int drawbartext(int x, int w, const char *text, const XftColor *bg) {
 	int ty = (BARH - (xfont->ascent + xfont->descent)) / 2 + xfont->ascent;
 	XSetForeground(dpy, gc, bg->pixel);
-	XFillRectangle(dpy, drawable, gc, x, 0, TEXTW(text), BARH);
+	XFillRectangle(dpy, drawable, gc, x, 0, w, BARH);
 	XftDrawStringUtf8(drawablexft, &cols[fg], xfont, x + (TEXTPAD / 2), ty,
 		(XftChar8 *)text, strlen(text));
-	return x + TEXTW(text);
+	return x + w;
 }
 
 
 /**
  * Re-render the bar, updating the status text and workspaces (tags).
  * If the bar is in launcher mode, draw the launcher status instead.
+ * The workspaces are only redrawn when the selection changed, or
+ * the bar was marked stale, otherwise only the status is redrawn.
+ * Only the drawn span, and what is left of the previous drawing,
+ * are blanked and copied to the bar window.
  */
 void drawbar() {
-	int i, x = 0, f = 0;
-
-	/* blank the drawable */
-	XSetForeground(dpy, gc, cols[bg].pixel);
-	XFillRectangle(dpy, drawable, gc, 0, 0, barpos[2], BARH);
+	static int drawnend = 0, drawnmode = 0; /* end of the last drawing, and its mode */
+	int i, x = 0, f = 0, dx, w;
+	long long start = nsnow();
+	unsigned long req = NextRequest(dpy);
+
+	/* switching modes, or losing the bar contents, needs a full redraw */
+	if (barfull || drawnmode != barcmds) {
+		drawnend = barpos[2];
+		bartags = 0;
+	}
+	barfull = 0;
+	drawnmode = barcmds;
 
 	if (barcmds) {
+		bartags = 0; /* the workspaces need redrawing after the launcher */
 		/* draw command filter (being typed) */
-		x = drawbartext(x, cmdfilter, &cols[bg]);
+		x = drawbartext(x, TEXTW(cmdfilter), cmdfilter, &cols[bg]);
 		/* draw command matches */
-		for (i = cmdi; i < NUMCMDS && cmds[i][0] && x < barpos[2]; i++)
-			if (!CMDCMP(i))
-				x = drawbartext(x, cmds[i], &cols[f++==0?mark:bg]);
+		for (i = cmdi; i < cmdslen && x < barpos[2]; i++)
+			if (CMDMATCH(i))
+				x = drawbartext(x, TEXTW(CMDNAME(i)), CMDNAME(i),
+					&cols[f++==0?mark:bg]);
 		/* highlight typed text if no match */
-		if (CMDCMP(cmdi))
-			drawbartext(0, cmdfilter, &cols[mark]);
+		if (!CMDMATCH(cmdi))
+			drawbartext(0, TEXTW(cmdfilter), cmdfilter, &cols[mark]);
+		dx = 0;
 	} else {
-		/* draw tags */
+		/* draw tags, if they changed */
 		for (i = 0; i < tagslen; i++)
-			x = drawbartext(x, tags[i], &cols[tagset&1<<i ?mark:bg]);
+			x = bartags == tagset ? x + tagsw[i]
+				: drawbartext(x, tagsw[i], tags[i], &cols[tagset&1<<i ?mark:bg]);
+		dx = bartags == tagset ? x : 0;
+		bartags = tagset;
 		/* draw status */
-		drawbartext(x, stxt, &cols[bg]);
+		x = drawbartext(x, TEXTW(stxt), stxt, &cols[bg]);
 	}
 
-	/* display composited bar */
-	XCopyArea(dpy, drawable, barwin, gc, 0, 0, barpos[2], BARH, 0, 0);
+	/* blank only what remains of the previous drawing */
+	x = MIN(x, barpos[2]);
+	w = MAX(drawnend, x);
+	if (x < w) {
+		XSetForeground(dpy, gc, cols[bg].pixel);
+		XFillRectangle(dpy, drawable, gc, x, 0, w - x, BARH);
+	}
+	drawnend = x;
+	/* display the redrawn part of the composited bar */
+	if (dx < w)
+		XCopyArea(dpy, drawable, barwin, gc, dx, 0, w - dx, BARH, dx, 0);
+	statadd(StatDrawbar, start, req);
+}
+
+
+/**
+ * Print the event handler and hot path statistics to stderr:
+ * the number of calls, the cumulative and maximum time taken,
+ * and the number of X requests issued (including nested calls).
+ * Notifications handled in a batch (see unmanage) are counted, with
+ * their time and requests folded into the first of the batch.
+ * Triggered by the SIGUSR1 signal (see sigstats).
+ */
+void dumpstats(void) {
+	char name[32];
+	int i;
+
+	fprintf(stderr, "filetwm: %-16s %10s %12s %10s %10s\n",
+		"stat", "calls", "total ms", "max ms", "requests");
+	for (i = 0; i < StatLast; i++)
+		if (stats[i].count) {
+			if (statnames[i])
+				snprintf(name, sizeof name, "%s", statnames[i]);
+			else /* events without a handler */
+				snprintf(name, sizeof name, "event %d", i);
+			fprintf(stderr, "filetwm: %-16s %10lu %12.3f %10.3f %10lu\n",
+				name, stats[i].count, stats[i].ns / 1e6, stats[i].maxns / 1e6,
+				stats[i].reqs);
+		}
+	dostats = 0;
 }
 
 
@@ -895,15 +1597,19 @@ void drawbar() {
  * client window in the stack.
  */
 void focus(Client *c) {
+	int i, l;
+
 	/* if c is not set or not visible, update c to be
 	   the currently selected window, if it is visible,
 	   otherwise search for the next visible window in
 	   the stack. */
 	if ((!c || !ISVISIBLE(c)) && (!(c = sel) || !ISVISIBLE(sel)))
-		/* search in layer order - floating then tiled then fullscreen */
-		for (int l = 0; l < 3 && (!c || !ISVISIBLE(c)); l++)
-			for (c = clients; c && ((c->full?2:c->tile?1:0) != l || !ISVISIBLE(c));
-				c = c->next);
+		/* search the visible clients in layer order -
+		   floating then tiled then fullscreen */
+		for (updatevis(), c = NULL, l = 0; l < 3 && !c; l++)
+			for (i = 0; i < vislen && !c; i++)
+				if ((vis[i]->full?2:vis[i]->tile?1:0) == l)
+					c = vis[i];
 
 	/* unfocus the previously selected window */
 	if (sel && sel != c)
@@ -920,7 +1626,7 @@ void focus(Client *c) {
 	if (sel && !barfocus) {
 		XSetInputFocus(dpy, sel->win, RevertToPointerRoot, CurrentTime);
 		PROPSET(root, NetActiveWindow, XA_WINDOW, 32, &sel->win, 1);
-		sendevent(sel, xatom[WMTakeFocus]);
+		sendevent(sel, WMTakeFocus);
 	} else {
 		XSetInputFocus(dpy, barwin, RevertToPointerRoot, CurrentTime);
 		XDeleteProperty(dpy, barwin, xatom[NetActiveWindow]);
@@ -936,16 +1642,34 @@ void focus(Client *c) {
  * Register all the keyboard shortcuts with the x server
  * so, as long as nothing else grabs the whole keyboard,
  * we will get keypress events when they are triggered.
+ * The keys are resolved to keycodes here, for looking up
+ * actions directly from key events (see keypress), and
+ * again whenever the keyboard mapping changes.
  */
 void grabkeys(XEvent *e) {
 	/* NumLock assumed to be Mod2Mask */
 	unsigned int mods[] = { 0, LockMask, Mod2Mask, Mod2Mask|LockMask };
-	/* Register capture of all configured keyboard shortcuts. */
+	KeySym syms[KcLast] = { XK_Left, XK_Right, XK_Return, XK_BackSpace,
+		XK_Escape, barshow, stackrelease };
+	KeyCode kc;
+
+	/* pick up the new mapping */
+	if (e && e->xmapping.request != MappingPointer)
+		XRefreshKeyboardMapping(&e->xmapping);
+	for (int i = 0; i < KcLast; i++)
+		kcodes[i] = KCODE(syms[i]);
+	/* Register capture of all configured keyboard shortcuts,
+	   with the first shortcut for each key taking the keycode. */
+	memset(keyacts, 0, sizeof keyacts);
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
-	for (int i = 0; i < keyslen; i++)
-		for (int j = 0; j < sizeof mods/sizeof *mods && KCODE(keys[i].key); j++)
-			XGrabKey(dpy, KCODE(keys[i].key), keys[i].mod | mods[j], root,
+	for (int i = 0; i < keyslen; i++) {
+		if (!(kc = KCODE(keys[i].key))) continue;
+		if (!keyacts[kc][KEYMODS(keys[i].mod)])
+			keyacts[kc][KEYMODS(keys[i].mod)] = &keys[i];
+		for (int j = 0; j < sizeof mods/sizeof *mods; j++)
+			XGrabKey(dpy, kc, keys[i].mod | mods[j], root,
 				True, GrabModeAsync, GrabModeAsync);
+	}
 }
 
 
@@ -956,7 +1680,10 @@ void grabkeys(XEvent *e) {
  * See grabresize.
  */
 void grabresizeabort() {
-	/* release the drag */
+	/* apply any remaining drag movement, then release the drag */
+	dragnext = dragsync = 0;
+	dragframe();
+	dragx = dragy = 0;
 	XUngrabPointer(dpy, CurrentTime);
 	if (sel && sel->tile && (ctrlmode == DragMove || ctrlmode == DragSize))
 		arrange(ctrlmode == DragMove ? sel : NULL, 1);
@@ -964,53 +1691,301 @@ void grabresizeabort() {
 }
 
 
+/**
+ * Populate the launcher with all the commands from the
+ * PATH environment variable, in the order they are found,
+ * and index them by name for filtering in the launcher.
+ * Directory listings are cached in the CMDCACHE file, against
+ * the directory modification times, so only directories that
+ * changed since the last scan are read again.
+ * This must be called with the HOME directory as the working directory.
+ */
+void loadcmds(void) {
+	int i, s, n;
+	char dirpath[4096], hdr[4096 + 64], *cache = NULL, *p, *e;
+	const char *path = getenv("PATH");
+	FILE *f;
+	DIR *dir;
+	struct dirent *d;
+	struct stat st;
+
+	/* add a command, recording it in the new cache */
+	#define ADDCMD(S, L) {addcmd(S, L); if (f) fprintf(f, "%.*s\n", (int)(L), S);}
+
+	/* load the previous cache, prefixed with a newline for line matching */
+	if ((f = fopen(CMDCACHE, "r"))) {
+		fseek(f, 0, SEEK_END);
+		n = ftell(f);
+		rewind(f);
+		if (n >= 0 && (cache = malloc(n + 2))) {
+			cache[0] = '\n';
+			cache[fread(cache + 1, 1, n, f) + 1] = '\0';
+		}
+		fclose(f);
+	}
+	mkdir(".cache", 0700);
+	f = fopen(CMDCACHE ".tmp", "w");
+
+	for (i = 0; path && i < strlen(path); i += s + 1) {
+		/* skip paths that are too long (4096 characters) */
+		if ((s = strcspn(&path[i], ":")) > 4096 - 1) continue;
+		strncpy(dirpath, &path[i], s);
+		dirpath[s] = '\0';
+		if (stat(dirpath, &st)) continue;
+		/* directory lines start with '/' which can't be in a command name */
+		snprintf(hdr, sizeof hdr, "\n/%lld.%09ld %s\n",
+			(long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, dirpath);
+		if (f) fputs(hdr + 1, f);
+		if (cache && (p = strstr(cache, hdr))) {
+			/* reuse the cached listing of an unchanged directory */
+			for (p += strlen(hdr); *p && *p != '/'; p = *e ? e + 1 : e) {
+				e = p + strcspn(p, "\n");
+				ADDCMD(p, e - p)
+			}
+			continue;
+		}
+		for (dir = opendir(dirpath); dir && (d = readdir(dir));)
+			if (d->d_name[0] != '.' && !strchr(d->d_name, '\n'))
+				ADDCMD(d->d_name, strlen(d->d_name))
+		if (dir) closedir(dir);
+	}
+	free(cache);
+	if (f && !fclose(f))
+		rename(CMDCACHE ".tmp", CMDCACHE);
+
+	/* trim the storage to fit, and index the commands by name */
+	if (cmdslen && (!(cmdnames = realloc(cmdnames, cmdnameslen))
+	|| !(cmds = realloc(cmds, cmdslen * sizeof(int)))
+	|| !(cmdsort = malloc(cmdslen * sizeof(int)))
+	|| !(cmdrank = malloc(cmdslen * sizeof(int)))))
+		DIE("malloc failed.\n");
+	for (i = 0; i < cmdslen; i++)
+		cmdsort[i] = i;
+	qsort(cmdsort, cmdslen, sizeof *cmdsort, cmdcmp);
+	for (i = 0; i < cmdslen; i++)
+		cmdrank[cmdsort[i]] = i;
+	cmdhi[0] = cmdslen;
+}
+
+
+/**
+ * Load the configured status text provider plugins (see statusplugins).
+ * Each plugin provides these functions:
+ *   int statusfd(void) - gives a file descriptor that becomes readable
+ *                        when the status should change (e.g. a timerfd).
+ *   void statustext(char *text, int size) - renders the status text,
+ *                        consuming the fd's pending input.
+ * The fds are polled with the X connection in the event loop (see main),
+ * and the rendered texts are joined to form the status text directly.
+ */
+void loadstatus(void) {
+	void *lib;
+	int (*fd)(void);
+
+	for (provslen = 0; statusplugins[provslen]; provslen++);
+	if (!(provs = calloc(provslen + 1, sizeof(Provider)))
+	|| !(pfds = calloc(provslen + 1, sizeof(struct pollfd))))
+		DIE("calloc failed.\n");
+	pfds[0] = (struct pollfd){.fd = ConnectionNumber(dpy), .events = POLLIN};
+	for (int i = 0; i < provslen; i++) {
+		if (!(lib = dlopen(statusplugins[i], RTLD_LAZY))
+		|| !(*(void **)(&fd) = dlsym(lib, "statusfd"))
+		|| !(*(void **)(&provs[i].text) = dlsym(lib, "statustext")))
+			DIE(dlerror());
+		pfds[i+1] = (struct pollfd){.fd = fd(), .events = POLLIN};
+		provs[i].text(provs[i].out, sizeof provs[i].out);
+	}
+}
+
+
 /**
  * This is called for any mouse movement event and handles
  * resizing during grabresize states (see grabresize),
  * raise and lowering the bar for the trigger-key
- * state (see barshow), watching for window-edge behaviour,
+ * state (see barshow), watching for window-edge behaviour
+ * of any visible window (see hitclient),
  * and managing focus-follows-mouse behaviour.
+ * The pointer and keyboard state are tracked from events
+ * (see motionnotify and exthandler), rather than queried.
  */
 void motion() {
 	int rx, ry, x, y;
-	static int lx = 0, ly = 0;
-	unsigned int mask;
-	char keystate[32];
+	unsigned int mask, kc = kcodes[KcBarShow];
 	Window cw;
 	static Client *c = NULL;
-
-	/* capture pointer and motion details */
-	if (!MOUSEINF(cw, rx, ry, mask)) return;
-	x = rx - lx; lx = rx;
-	y = ry - ly; ly = ry;
-
-	#define WV(V) (sel->tile ? sel->V : sel->f##V)
-	/* handle any drag modes */
-	if (sel && ctrlmode == DragMove)
-		resize(sel, WV(x)+x, WV(y)+y, WV(w), WV(h), 1);
-	if (sel && ctrlmode == DragSize)
-		resize(sel, WV(x), WV(y), WV(w)+x, WV(h)+y, 1);
-	/* update the monitor layout to match any tiling changes */
-	if (sel && sel->tile && (ctrlmode == DragMove || ctrlmode == DragSize))
-		arrange(sel, 0);
+	Client *h;
+
+	/* resync with the server only if neither core motion events nor raw
+	   relative motion followed the movement (such as absolute devices) */
+	if (!ptrsync && MOUSEINF(cw, rx, ry, mask)) {
+		ptrdx += rx - ptrx; ptrx = rx;
+		ptrdy += ry - ptry; ptry = ry;
+		ptrmask = mask; ptrwin = cw;
+	}
+	/* capture and consume the pointer movement */
+	rx = ptrx; ry = ptry; x = ptrdx; y = ptrdy;
+	mask = ptrmask; cw = ptrwin;
+	ptrdx = ptrdy = ptrsync = 0;
+
+	/* handle any drag modes, paced to the display (see dragframe) */
+	if (ctrlmode == DragMove || ctrlmode == DragSize) {
+		dragx += x;
+		dragy += y;
+		dragframe();
+	}
 	if (ctrlmode == WinEdge && /* watch for mouse over window edge */
 		(!sel || (!MOVEZONE(sel, rx, ry) && !RESIZEZONE(sel, rx, ry))))
 		grabresizeabort();
 	if (ctrlmode != CtrlNone) return;
 
 	/* raise the bar when trigger key is held down during mouse move */
-	XQueryKeymap(dpy, keystate);
-	restack(NULL, (keystate[KCODE(barshow)/8] & (1 << (KCODE(barshow)%8)))
-		|| barcmds ? BarShow : BarHide);
+	restack(NULL, (keydown[kc/8] & (1 << (kc%8))) || barcmds ? BarShow : BarHide);
 
 	/* focus follows client window under mouse (cached for speed) */
 	if (cw != lastcw && (c = wintoclient(cw)) && c != sel)
 		focus(c);
 	lastcw = cw;
 
-	/* watch for border edge locations for resizing */
-	if (sel && !mask && (MOVEZONE(sel, rx, ry) || RESIZEZONE(sel, rx, ry)))
+	/* watch for border edge locations of the top window for resizing,
+	   unless the pointer is over an unmanaged window (such as a menu) */
+	if (!mask && (!cw || wintoclient(cw)) && (h = hitclient(rx, ry)) && !h->full
+	&& (MOVEZONE(h, rx, ry) || RESIZEZONE(h, rx, ry))) {
+		if (h != sel) focus(h);
 		grabresize(&(Arg){.i = WinEdge});
+	}
+}
+
+
+/**
+ * Size the bar window, and the drawable it is drawn from, to the
+ * configured bar geometry. The drawable is only recreated when the
+ * size changed, and then the whole bar is redrawn.
+ */
+void resizebar(void) {
+	static int w = 0, h = 0;
+	int screen = DefaultScreen(dpy);
+
+	if (barwin)
+		XMoveResizeWindow(dpy, barwin, barpos[0], barpos[1], barpos[2], BARH);
+	if (drawable && w == barpos[2] && h == BARH) return;
+	if (drawable) {
+		XftDrawDestroy(drawablexft);
+		XFreePixmap(dpy, drawable);
+	}
+	drawable = XCreatePixmap(dpy, root, (w = MAX(barpos[2], 1)), (h = BARH),
+		DefaultDepth(dpy, screen));
+	drawablexft = XftDrawCreate(dpy, drawable, DefaultVisual(dpy, screen),
+		DefaultColormap(dpy, screen));
+	barfull = 1;
+	if (barwin) drawbar();
+}
+
+
+/**
+ * Manage the windows already open on the screen, such as after a
+ * restart, in one pass. Clients saved before the restart (see
+ * savesession) have their workspaces, layers, floating geometry and
+ * client list order restored, along with the displayed workspaces.
+ * Other windows are managed as if newly mapped.
+ */
+void restoresession(void) {
+	unsigned int i, j, n, k;
+	unsigned long len = 0;
+	long *snap = NULL, *v;
+	Atom da;
+	Window dw, *kids = NULL;
+	Client *c;
+	xcb_connection_t *xc = XGetXCBConnection(dpy);
+	xcb_get_window_attributes_reply_t *wa;
+	#define ADOPT(W) maprequest(&(XEvent){.xmaprequest = {.type = MapRequest,\
+		.window = W}})
+
+	/* take the saved session, as a tagset and a record per client */
+	if (XGetWindowProperty(dpy, root, xatom[FiletSession], 0L, 1L << 24, True,
+		XA_CARDINAL, &da, &di, &len, &dl, (unsigned char **)&snap) != Success)
+		snap = NULL;
+	if (!snap || !len || (len - 1) % SESSIONREC) len = 0;
+	if (len && snap[0] & TAGMASK) tagset = snap[0] & TAGMASK;
+	if (!XQueryTree(dpy, root, &dw, &dw, &kids, &n)) n = 0;
+
+	/* find the mapped windows, with all the queries sent before any reply */
+	{
+		xcb_get_window_attributes_cookie_t wac[n ? n : 1];
+		for (i = 0; i < n; i++)
+			wac[i] = xcb_get_window_attributes(xc, kids[i]);
+		for (i = 0; i < n; i++) {
+			wa = xcb_get_window_attributes_reply(xc, wac[i], NULL);
+			if (!wa || wa->override_redirect || wa->map_state != XCB_MAP_STATE_VIEWABLE)
+				kids[i] = None;
+			free(wa);
+		}
+	}
+
+	restoring = 1;
+	/* manage the unsaved windows, bottom of the stack first */
+	for (i = 0; i < n; i++) {
+		for (j = 1; j < len && (Window)snap[j] != kids[i]; j += SESSIONREC);
+		if (kids[i] && j >= len) ADOPT(kids[i]);
+	}
+	/* then the saved clients, attached to the front of the client list
+	   in reverse so the saved order is restored */
+	for (k = len; k > 1; k -= SESSIONREC) {
+		v = &snap[k - SESSIONREC];
+		for (i = 0; i < n && kids[i] != (Window)v[0]; i++);
+		if (i == n || !kids[i]) continue;
+		ADOPT(kids[i]);
+		if (!(c = wintoclient(kids[i]))) continue;
+		c->tags = v[1] & TAGMASK ? v[1] & TAGMASK : c->tags;
+		c->tile = v[2] & 1;
+		c->chain = !!(v[2] & 2);
+		if (!c->full) resize(c, (int)v[3], (int)v[4], (int)v[5], (int)v[6], 1);
+		else {
+			/* the floating geometry to return to (see setfullscreen) */
+			c->fx = (int)v[3];
+			c->fy = (int)v[4];
+			c->fw = (int)v[5];
+			c->fh = (int)v[6];
+		}
+	}
+	#undef ADOPT
+	restoring = 0;
+	/* the saved workspaces and layers changed what's visible */
+	visstale = hidestale = hitstale = 1;
+	if (snap) XFree(snap);
+	if (kids) XFree(kids);
+
+	/* lay out and stack all the clients once */
+	arrange(NULL, 0);
+	restack(NULL, CliNone);
+}
+
+
+/**
+ * Save the state of the clients to the root window, to be restored
+ * when the window manager starts again (see restoresession): the
+ * displayed workspaces, then for each client in client list order, its
+ * window, workspaces, layers (tiled and chained) and floating geometry.
+ */
+void savesession(void) {
+	long *snap;
+	int n;
+	Client *c;
+
+	for (n = 1, c = clients; c; c = c->next, n += SESSIONREC);
+	if (!(snap = calloc(n, sizeof(long))))
+		DIE("calloc failed.\n");
+	snap[0] = tagset;
+	for (n = 1, c = clients; c; c = c->next, n += SESSIONREC) {
+		snap[n] = c->win;
+		snap[n+1] = c->tags;
+		snap[n+2] = c->tile | c->chain << 1;
+		snap[n+3] = c->fx;
+		snap[n+4] = c->fy;
+		snap[n+5] = c->fw;
+		snap[n+6] = c->fh;
+	}
+	PROPSET(root, FiletSession, XA_CARDINAL, 32, snap, n);
+	free(snap);
 }
 
 
@@ -1030,10 +2005,9 @@ void setfullscreen(Client *c, int fullscreen) {
 		c->fbw = c->bw;
 		c->bw = 0;
 		/* find the full screen spread across the monitors */
-		for (m1 = monslen-1; m1 > 0 && !INMON(c->x, c->y, mons[m1]); m1--);
-		for (m2 = 0; m2 < monslen
-		&& !INMON(c->x + WIDTH(c), c->y + HEIGHT(c), mons[m2]); m2++);
-		if (m2 == monslen || mons[m2].mx + mons[m2].mw <= mons[m1].mx
+		m1 = monat(c->x, c->y, 0, 0);
+		m2 = monat(c->x + WIDTH(c), c->y + HEIGHT(c), -1, 1);
+		if (m2 < 0 || mons[m2].mx + mons[m2].mw <= mons[m1].mx
 		|| mons[m2].my + mons[m2].mh <= mons[m1].my)
 			m2 = m1;
 		/* apply fullscreen window parameters */
@@ -1053,10 +2027,30 @@ void setfullscreen(Client *c, int fullscreen) {
 }
 
 
+/**
+ * Launch a command from the launcher, without any trailing spaces.
+ * @name: the command to launch.
+ */
+void spawncmd(const char *name) {
+	char ***spawner, cmd[strlen(name) + 1];
+
+	strcpy(cmd, name);
+	/* trim trailing spaces */
+	for (;strlen(cmd) && cmd[strlen(cmd)-1] == ' '; cmd[strlen(cmd)-1] = '\0');
+	/* launch the command */
+	spawner = (char***)&(char*[]){cmd, NULL};
+	spawn(&(Arg){.v = &spawner});
+}
+
+
 /**
  * Stop managing the given client as a client window
  * of this window manager. Update the selected window
  * if needed.
+ * The clients of any unmap and destroy notifications queued right
+ * behind it are unmanaged with it, such as when a program exits and
+ * takes many windows with it, so the client list, layout and stacking
+ * are only updated once.
  * @c: the client to unmanage.
  * Note that in some situations, client windows could
  * persist after being unmapped, and be left with
@@ -1068,12 +2062,97 @@ void setfullscreen(Client *c, int fullscreen) {
  * after unmapping.
  */
 void unmanage(Client *c) {
-	restack(c, CliRemove);
+	int i, n;
+	XEvent ev;
+
+	unmanaging = 1;
+	while (c) {
+		restack(c, CliRemove);
+		freeclient(c);
+		/* take the next queued notification for a managed window */
+		for (c = NULL; !c && XQLength(dpy) && (XPeekEvent(dpy, &ev),
+			ev.type == DestroyNotify || ev.type == UnmapNotify);) {
+			XNextEvent(dpy, &ev);
+			traceevent(&ev);
+			/* counted, with its time in the first notification's */
+			statadd(ev.type, nsnow(), NextRequest(dpy));
+			c = ev.type == DestroyNotify ? wintoclient(ev.xdestroywindow.window)
+				: !ev.xunmap.send_event ? wintoclient(ev.xunmap.window) : NULL;
+		}
+	}
+	unmanaging = 0;
+	/* remove the windows from the client list, published when the queue
+	   is clear (see main) */
+	for (i = n = 0; i < clientwinslen; i++)
+		if (wintoclient(clientwins[i])) clientwins[n++] = clientwins[i];
+	clientwinslen = n;
+	doclientlist = 1;
 	arrange(NULL, 0);
-	free(c);
-	XDeleteProperty(dpy, root, xatom[NetClientList]);
-	for (c = clients; c; c = c->next)
-		PROPADD(Append, root, NetClientList, XA_WINDOW, 32, &c->win, 1);
+	restack(NULL, CliNone);
+}
+
+
+/**
+ * Find the pointer devices moving relatively, whose raw motion
+ * deltas can follow the pointer without querying it (see exthandler).
+ */
+void updatedevices(void) {
+	int i, j, n;
+	XIDeviceInfo *devs = XIQueryDevice(dpy, XIAllDevices, &n);
+	XIValuatorClassInfo *v;
+
+	memset(ptrrel, 0, sizeof ptrrel);
+	for (i = 0; devs && i < n; i++)
+		for (j = 0; j < devs[i].num_classes && devs[i].deviceid < 256; j++) {
+			v = (XIValuatorClassInfo *)devs[i].classes[j];
+			if (v->type == XIValuatorClass && v->number == 0
+			&& v->mode == XIModeRelative)
+				ptrrel[devs[i].deviceid/8] |= 1 << devs[i].deviceid%8;
+		}
+	if (devs) XIFreeDeviceInfo(devs);
+}
+
+
+/**
+ * Index the monitors for point lookups (see monat), by the sorted
+ * distinct edges of the monitors, splitting the screen into cells
+ * each covered by at most one monitor.
+ */
+void updatemonindex(void) {
+	int i, j, k, l, m, *e, *n;
+
+	if (!(monxs = realloc(monxs, 2 * monslen * sizeof(int)))
+	|| !(monys = realloc(monys, 2 * monslen * sizeof(int)))
+	|| !(monlay = realloc(monlay, monslen * sizeof(MonLayout))))
+		DIE("realloc failed.\n");
+	/* insert each monitor edge in order, skipping duplicates */
+	#define EDGEADD(E, N, V) {e = E; n = &N; k = V;\
+		for (i = 0; i < *n && e[i] < k; i++);\
+		if (i == *n || e[i] != k) {\
+			memmove(&e[i+1], &e[i], (*n - i) * sizeof(int));\
+			e[i] = k;\
+			++*n;\
+		}}
+	for (monnx = monny = m = 0; m < monslen; m++) {
+		EDGEADD(monxs, monnx, mons[m].mx)
+		EDGEADD(monxs, monnx, mons[m].mx + mons[m].mw)
+		EDGEADD(monys, monny, mons[m].my)
+		EDGEADD(monys, monny, mons[m].my + mons[m].mh)
+	}
+	/* fill the cells covered by each monitor, in two layers: with later
+	   monitors on top, then with earlier monitors on top (see monat) */
+	k = MAX(1, (monnx-1) * (monny-1));
+	if (!(moncells = realloc(moncells, 2 * k * sizeof(int))))
+		DIE("realloc failed.\n");
+	for (i = 0; i < 2 * k; i++) moncells[i] = -1;
+	for (l = 0; l < 2 * monslen; l++) {
+		m = l < monslen ? l : 2 * monslen - 1 - l;
+		for (i = edgecell(monxs, monnx, mons[m].mx);
+			i >= 0 && monxs[i] < mons[m].mx + mons[m].mw; i++)
+			for (j = edgecell(monys, monny, mons[m].my);
+				j >= 0 && monys[j] < mons[m].my + mons[m].mh; j++)
+				moncells[(l < monslen ? 0 : k) + i*(monny-1)+j] = m;
+	}
 }
 
 
@@ -1085,16 +2164,78 @@ void updatemonitors() {
 	Monitor m;
 	XRRMonitorInfo *inf;
 
-	inf = XRRGetMonitors(dpy, root, 1, &n);
-	for (i = 0; i < n && i < monslen; i++) {
+	/* keep the last layout while no monitors are active (e.g. docking) */
+	if (!(inf = XRRGetMonitors(dpy, root, 1, &n)) || !n) {
+		if (inf) XRRFreeMonitors(inf);
+		return;
+	}
+	for (i = 0; i < monslen; i++) {
+		if (i >= n) {
+			mons[i] = (Monitor){0}; /* disconnected */
+			continue;
+		}
 		SETMON(mons[i], inf[i])
 		if (inf[i].primary)
 			pri = i;
 	}
+	XRRFreeMonitors(inf);
 	/* push the primary monitor to the top */
 	m = mons[pri];
 	mons[pri] = mons[0];
 	mons[0] = m;
+	updatemonindex();
+}
+
+
+/**
+ * Find the refresh interval of the fastest active display,
+ * for pacing window drags (see dragframe).
+ */
+void updaterate(void) {
+	int i, j;
+	long long ns = 0;
+	XRRScreenResources *res;
+	XRRCrtcInfo *crtc;
+	XRRModeInfo *mode;
+
+	if (!(res = XRRGetScreenResourcesCurrent(dpy, root))) return;
+	for (i = 0; i < res->ncrtc; i++) {
+		if (!(crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i]))) continue;
+		for (j = 0; j < res->nmode; j++)
+			if ((mode = &res->modes[j])->id == crtc->mode && mode->dotClock
+			&& (!ns || 1000000000LL * mode->hTotal * mode->vTotal / mode->dotClock < ns))
+				ns = 1000000000LL * mode->hTotal * mode->vTotal / mode->dotClock;
+		XRRFreeCrtcInfo(crtc);
+	}
+	XRRFreeScreenResources(res);
+	framens = ns ? ns : 1000000000LL / 60;
+}
+
+
+/**
+ * Apply a burst of screen changes once it has settled (see rrnotify)
+ * and the event queue is clear: querying the monitors once, updating
+ * the screen geometry and the bar, then arranging and restacking once.
+ * Returns the milliseconds until the burst could have settled,
+ * or -1 if there are no screen changes waiting.
+ */
+int updatescreen(void) {
+	int screen = DefaultScreen(dpy);
+	long long now = nsnow();
+
+	if (!screenat) return -1;
+	if (screenat > now) return (screenat - now + 999999) / 1000000;
+	if (XQLength(dpy)) return 0;
+	screenat = 0;
+	sw = DisplayWidth(dpy, screen);
+	sh = DisplayHeight(dpy, screen);
+	if (monauto) updatemonitors();
+	updaterate();
+	resizebar();
+	hitstale = 1; /* the hit grid spans the screen */
+	arrange(NULL, 0);
+	restack(NULL, CliNone);
+	return -1;
 }
 
 
@@ -1102,20 +2243,29 @@ void updatemonitors() {
  * The status message on the bar is update by changing
  * the name of the root window. This method requeries the
  * root window name for any updates and redraws the
- * the new message to the bar.
+ * the new message to the bar, if it changed.
  */
 void updatestatus(void) {
-	char **v = NULL;
+	char **v = NULL, text[sizeof stxt] = "";
+	int i, n, changed = !bartags;
 	XTextProperty p;
 
-	if (XGetTextProperty(dpy, root, &p, XA_WM_NAME) && p.nitems) {
+	if (provslen) {
+		/* join the texts of the status providers (see loadstatus) */
+		for (i = n = 0; i < provslen && n < sizeof text - 1; i++)
+			n += snprintf(&text[n], sizeof text - n, "%s%s", n ? " " : "",
+				provs[i].out);
+		changed |= strcmp(stxt, text) != 0;
+		strcpy(stxt, text);
+	} else if (XGetTextProperty(dpy, root, &p, XA_WM_NAME) && p.nitems) {
 		if (XmbTextPropertyToTextList(dpy, &p, &v, &di) >= Success && *v) {
+			changed |= strncmp(stxt, *v, sizeof(stxt) - 1) != 0;
 			strncpy(stxt, *v, sizeof(stxt) - 1);
 			XFreeStringList(v);
 		}
 		XFree(p.value);
 	}
-	drawbar();
+	if (changed) drawbar();
 }
 
 
@@ -1132,7 +2282,7 @@ void updatestatus(void) {
 void buttonpress(XEvent *e) {
 	unsigned int i;
 	int x = 0, click;
-	char ***spawner, cmd[LENCMD];
+	const char *cmd;
 	Client *c;
 	Arg arg = {0};
 	XButtonPressedEvent *ev = &e->xbutton;
@@ -1140,7 +2290,7 @@ void buttonpress(XEvent *e) {
 	/* click actions for the bar */
 	if (ev->window == barwin && !barcmds) {
 		/* check for click on one of the tags (workspaces)  */
-		for (i = 0; i < tagslen && ev->x > (x += TEXTW(tags[i])); i++);
+		for (i = 0; i < tagslen && ev->x > (x += tagsw[i]); i++);
 		click = i >= tagslen ? ClkStatus : tagset & 1 << i ? ClkSelTag : ClkTagBar;
 		/* if unselected tag clicked, auto set argument to tag number */
 		if (click == ClkTagBar)
@@ -1151,18 +2301,14 @@ void buttonpress(XEvent *e) {
 				buttons[i].func(arg.ui ? &arg : &buttons[i].arg);
 	} else if (ev->window == barwin && barcmds) {
 		/* click actions for the launcher */
-		strcpy(cmd, cmdfilter);
+		cmd = cmdfilter;
 		x = TEXTW(cmdfilter);
-		for (i = cmdi; ev->x > x && i < NUMCMDS && cmds[i][0]; i++)
-			if (!CMDCMP(i)) {
-				x += TEXTW(cmds[i]);
-				strcpy(cmd, cmds[i]);
+		for (i = cmdi; ev->x > x && i < cmdslen; i++)
+			if (CMDMATCH(i)) {
+				x += TEXTW(CMDNAME(i));
+				cmd = CMDNAME(i);
 			}
-		/* trim trailing spaces */
-		for (;strlen(cmd) && cmd[strlen(cmd)-1] == ' '; cmd[strlen(cmd)-1] = '\0');
-		/* launch the command */
-		spawner = (char***)&(char*[]){cmd, NULL};
-		spawn(&(Arg){.v = &spawner});
+		spawncmd(cmd);
 	} else {
 		/* other click actions */
 		launcher(&(Arg){.i = 0});
@@ -1205,7 +2351,8 @@ void clientmessage(XEvent *e) {
  * to the border width for client windows as this
  * isn't allowed.
  * Requests for unmanaged windows are just applied
- * in full.
+ * in full. Queued requests for a managed window are
+ * collapsed into the latest one.
  */
 void configurerequest(XEvent *e) {
 	Client *c;
@@ -1224,9 +2371,13 @@ void configurerequest(XEvent *e) {
 		if (ev->value_mask & CWStackMode)
 			wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
-	} else if (!c->tile && !c->full && ISVISIBLE(c))
+	} else if (!c->tile && !c->full && ISVISIBLE(c)) {
+		/* skip to the latest request (they hold the full geometry) */
+		while (XCheckIfEvent(dpy, e, samecfgevent, (XPointer)&c->win))
+			traceevent(e);
 		/* allow resizing of managed floating windows in active workspaces */
 		resize(c, ev->x, ev->y, ev->width, ev->height, 0);
+	}
 }
 
 
@@ -1244,34 +2395,67 @@ void destroynotify(XEvent *e) {
 
 
 /*
- * Handle raw presses, releases, mouse motion events,
- * and monitor changes.
+ * Handle raw presses, releases, and mouse motion events.
  * This does not handle the keyboard shorcuts, but rather
  * the additional keyboard related functionaltily:
  *  - barshow (show bar when held down),
  *  - stackrelease (reorder window stack on key release)
  *  - ending resize or move actions on any key release.
  * See the keyproess function for keyboard shortcut handling.
+ * Raw motion of relative devices also follows the pointer
+ * position, and device changes are tracked for that.
  */
 void exthandler(XEvent *ev) {
+	static double fx = 0, fy = 0; /* movement not yet whole pixels */
+	int i, x, y, kc = 0;
+	double d[2] = {0}, *v;
+	XIRawEvent *re;
+
 	switch (ev->xcookie.evtype) {
-	default: /* must be an XRandR output change event */
-		updatemonitors();
-		return;
 	case XI_RawMotion:
+		/* follow the pointer from the (accelerated) deltas of relative
+		   devices, leaving others to be queried (see motion) */
+		if (XGetEventData(dpy, &ev->xcookie)) {
+			re = ev->xcookie.data;
+			if (re->sourceid < 256 && ptrrel[re->sourceid/8] & 1 << re->sourceid%8) {
+				for (i = 0, v = re->valuators.values; i < 2
+				&& i < re->valuators.mask_len * 8; i++)
+					if (XIMaskIsSet(re->valuators.mask, i)) d[i] = *v++;
+				fx += d[0];
+				fy += d[1];
+				x = MAX(0, MIN(sw - 1, ptrx + (int)fx));
+				y = MAX(0, MIN(sh - 1, ptry + (int)fy));
+				fx -= (int)fx;
+				fy -= (int)fy;
+				ptrdx += x - ptrx; ptrx = x;
+				ptrdy += y - ptry; ptry = y;
+				ptrsync = 1;
+			}
+			XFreeEventData(dpy, &ev->xcookie);
+		}
 		domotion = 1; /* defer motion processing */
 		return;
+	case XI_HierarchyChanged:
+		updatedevices();
+		return;
+	case XI_RawKeyPress:
 	case XI_RawKeyRelease:
+		/* track the key states (see motion) */
+		if (XGetEventData(dpy, &ev->xcookie)) {
+			kc = ((XIRawEvent *)ev->xcookie.data)->detail % 256;
+			XFreeEventData(dpy, &ev->xcookie);
+		}
+		if (ev->xcookie.evtype == XI_RawKeyPress) {
+			keydown[kc/8] |= 1 << (kc%8);
+			return;
+		}
+		keydown[kc/8] &= ~(1 << (kc%8));
 		/* zoom after cycling windows if releasing the modifier key, this gives
 			 AltTab+Tab...select behavior like with common window managers */
-		if (ctrlmode == ZoomStack) {
-			XGetEventData(dpy, &ev->xcookie);
-			XIRawEvent *re = ev->xcookie.data;
-			if (KCODE(stackrelease) == re->detail) {
-				ctrlmode = CtrlNone;
-				restack(sel, CliZoom);
-				arrange(NULL, 0); /* zooming tiled windows can rearrange tiling */
-			}
+		if (ctrlmode == ZoomStack && kcodes[KcStackRelease] == kc) {
+			ctrlmode = CtrlNone;
+			restack(sel, CliZoom);
+			arrange(NULL, 0); /* zooming tiled windows can rearrange tiling */
 		}
 	case XI_RawButtonRelease:
 		if (ctrlmode != ZoomStack) grabresizeabort();
@@ -1286,8 +2470,21 @@ void exthandler(XEvent *ev) {
  * the status bar.
  */
 void expose(XEvent *e) {
-	if (e->xexpose.count == 0)
+	if (e->xexpose.count == 0) {
+		barfull = 1;
 		drawbar();
+	}
+}
+
+
+/**
+ * Handle focus in events, resyncing the key states (see exthandler)
+ * when a keyboard grab ends, since key events can be missed while
+ * another client has the keyboard grabbed (before XI 2.1).
+ */
+void focusin(XEvent *e) {
+	if (e->xfocus.mode == NotifyUngrab)
+		XQueryKeymap(dpy, keydown);
 }
 
 
@@ -1298,39 +2495,35 @@ void expose(XEvent *e) {
  * Also handle events for the launcher.
  */
 void keypress(XEvent *e) {
-	char ***spawner, cmd[LENCMD];
+	int n;
+	Key *k;
 
 	/* handle configured actions */
-	for (int i = 0; i < keyslen; i++)
-		if (e->xkey.keycode == KCODE(keys[i].key)
-		&& KEYMASK(keys[i].mod) == KEYMASK(e->xkey.state)) {
-			keys[i].func(&(keys[i].arg));
-			return;
-		}
+	if ((k = keyacts[e->xkey.keycode & 0xff][KEYMODS(e->xkey.state)])) {
+		k->func(&(k->arg));
+		return;
+	}
 	if (!barcmds) return;
 
 	/* handle launcher input */
-	if (KCODE(XK_Left) == e->xkey.keycode)
+	if (kcodes[KcLeft] == e->xkey.keycode)
 		CMDFIND(cmdi - 1, -1)
-	else if (KCODE(XK_Right) == e->xkey.keycode)
+	else if (kcodes[KcRight] == e->xkey.keycode)
 		CMDFIND(cmdi + 1, +1)
-	else if (KCODE(XK_Return) == e->xkey.keycode) {
+	else if (kcodes[KcReturn] == e->xkey.keycode) {
 		/* execute the selected command or the command filter itself */
-		strcpy(cmd, !CMDCMP(cmdi) ? cmds[cmdi] : cmdfilter);
-		/* trim trailing spaces */
-		for (;strlen(cmd) && cmd[strlen(cmd)-1] == ' '; cmd[strlen(cmd)-1] = '\0');
-		/* launch the command */
-		spawner = (char***)&(char*[]){cmd, NULL};
-		spawn(&(Arg){.v = &spawner});
-	} else if (KCODE(XK_BackSpace) == e->xkey.keycode) {
+		spawncmd(CMDMATCH(cmdi) ? CMDNAME(cmdi) : cmdfilter);
+	} else if (kcodes[KcBackSpace] == e->xkey.keycode) {
 		cmdfilter[MAX(strlen(cmdfilter)-1, 0)] = '\0';
 		CMDFIND(0, +1)
 	} else {
-		KCHAR(&e->xkey, &cmdfilter[strlen(cmdfilter)], LENCMD-strlen(cmdfilter)-1);
+		n = strlen(cmdfilter);
+		KCHAR(&e->xkey, &cmdfilter[n], LENCMD-n-1);
+		filtercmds(n);
 		CMDFIND(0, +1)
 	}
 	/* redraw the bar commands or close launcher */
-	launcher(&(Arg){.i = (KCODE(XK_Escape) != e->xkey.keycode)});
+	launcher(&(Arg){.i = (kcodes[KcEscape] != e->xkey.keycode)});
 }
 
 
@@ -1338,38 +2531,111 @@ void keypress(XEvent *e) {
  * Handle map request events.
  * This registers the window as a managed
  * client and initialises its state.
+ * The window details are all queried together (via XCB),
+ * so they only cost a single round trip to the X server.
  */
 void maprequest(XEvent *e) {
-	int x, y, m;
+	int i, n, m = 0, manage, full;
 	long state[] = { NormalState, None };
+	Atom protos[32]; /* matching the queried length */
+	uint32_t *v;
 	Client *c, *t = NULL;
 	Window trans = None;
+	XSizeHints size = {0};
 	XWindowChanges wc;
-	XWindowAttributes wa;
 	XMapRequestEvent *ev = &e->xmaprequest;
-
-	if (!XGetWindowAttributes(dpy, ev->window, &wa) || wa.override_redirect
-	|| wintoclient(ev->window)) return;
+	xcb_connection_t *xc = XGetXCBConnection(dpy);
+	xcb_get_window_attributes_cookie_t wac;
+	xcb_get_window_attributes_reply_t *wa;
+	xcb_get_geometry_cookie_t gec;
+	xcb_get_geometry_reply_t *geo;
+	xcb_get_property_cookie_t trc, hic, stc, prc, byc;
+	xcb_get_property_reply_t *tr, *hi, *st, *pr, *by;
+	xcb_query_pointer_cookie_t poc;
+	xcb_query_pointer_reply_t *po;
+
+	if (wintoclient(ev->window)) return;
+
+	/* send all the queries before waiting for any replies */
+	#define GETPROP(P, T, L) xcb_get_property(xc, 0, ev->window, P, T, 0, L)
+	wac = xcb_get_window_attributes(xc, ev->window);
+	gec = xcb_get_geometry(xc, ev->window);
+	trc = GETPROP(XA_WM_TRANSIENT_FOR, XA_WINDOW, 1);
+	hic = GETPROP(XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 18);
+	stc = GETPROP(xatom[NetWMState], XA_ATOM, 1);
+	prc = GETPROP(xatom[WMProtocols], XA_ATOM, 32);
+	byc = GETPROP(xatom[NetWMBypassCompositor], XA_CARDINAL, 1);
+	poc = xcb_query_pointer(xc, root);
+	/* collect the replies (errors go to the xerror handler) */
+	#define PROPVAL(R, N) (R && R->format == 32\
+		&& xcb_get_property_value_length(R) >= 4 * N ? xcb_get_property_value(R) : 0)
+	wa = xcb_get_window_attributes_reply(xc, wac, NULL);
+	geo = xcb_get_geometry_reply(xc, gec, NULL);
+	tr = xcb_get_property_reply(xc, trc, NULL);
+	hi = xcb_get_property_reply(xc, hic, NULL);
+	st = xcb_get_property_reply(xc, stc, NULL);
+	pr = xcb_get_property_reply(xc, prc, NULL);
+	by = xcb_get_property_reply(xc, byc, NULL);
+	po = xcb_query_pointer_reply(xc, poc, NULL);
+
+	/* unpack the replies */
+	manage = wa && geo && !wa->override_redirect;
+	if ((v = PROPVAL(tr, 1)))
+		trans = v[0];
+	if ((v = PROPVAL(hi, 15))) { /* see XGetWMNormalHints */
+		size.flags = v[0];
+		size.min_width = v[5];
+		size.min_height = v[6];
+		size.max_width = v[7];
+		size.max_height = v[8];
+		size.min_aspect.x = v[11];
+		size.min_aspect.y = v[12];
+		size.max_aspect.x = v[13];
+		size.max_aspect.y = v[14];
+		if (PROPVAL(hi, 18)) {
+			size.base_width = v[15];
+			size.base_height = v[16];
+		} else size.flags &= ~(PBaseSize|PWinGravity); /* old hints */
+	}
+	full = (v = PROPVAL(st, 1)) && v[0] == xatom[NetWMFullscreen];
+	/* find current monitor */
+	if (po && po->same_screen)
+		m = monat(po->root_x, po->root_y, 0, 0);
 
 	/* manage the window by registering it as a new client */
-	if (!(c = calloc(1, sizeof(Client))))
-		DIE("calloc failed.\n");
+	if (manage) {
+		c = newclient();
+		c->win = ev->window;
+		/* geometry */
+		c->fx = geo->x;
+		c->fy = geo->y;
+		c->fw = geo->width;
+		c->fh = geo->height;
+		/* supported protocols (widened from xcb's 32 bit atoms) */
+		if ((v = PROPVAL(pr, 1))) {
+			n = MIN(32, xcb_get_property_value_length(pr) / 4);
+			for (i = 0; i < n; i++) protos[i] = v[i];
+			updateprotocols(c, protos, n);
+		}
+		if ((v = PROPVAL(by, 1)))
+			c->bypass = v[0];
+	}
+	free(wa);
+	free(geo);
+	free(tr);
+	free(hi);
+	free(st);
+	free(pr);
+	free(by);
+	free(po);
+	if (!manage) return;
 	attach(c, NULL);
-	c->win = ev->window;
 	c->tags = tagset;
-	/* geometry */
-	c->fx = wa.x;
-	c->fy = wa.y;
-	c->fw = wa.width;
-	c->fh = wa.height;
 	/* show window on same workspaces as its parent, if it has one */
-	if (XGetTransientForHint(dpy, ev->window, &trans) && (t = wintoclient(trans)))
+	if ((t = wintoclient(trans)))
 		c->tags = t->tags;
+	visstale = hidestale = 1;
 
-	/* find current monitor */
-	if (MOUSEINF(dwin, x, y, dui))
-		for (m = monslen-1; m > 0 && !INMON(x, y, mons[m]); m--);
-	else m = 0;
 	/* adjust to current monitor */
 	if (c->fx + WIDTH(c) > mons[m].mx + mons[m].mw)
 		c->fx = mons[m].mx + mons[m].mw - WIDTH(c);
@@ -1381,32 +2647,70 @@ void maprequest(XEvent *e) {
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, ev->window, CWBorderWidth, &wc);
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatesizehints(c);
-	XSelectInput(dpy, ev->window, PropertyChangeMask|StructureNotifyMask);
-	PROPADD(Append, root, NetClientList, XA_WINDOW, 32, &c->win, 1);
+	updatesizehints(c, &size);
+	XSelectInput(dpy, ev->window, PropertyChangeMask|StructureNotifyMask
+		|EnterWindowMask|FocusChangeMask);
+	/* add to the client list, published when the queue is clear (see main) */
+	if (clientwinslen == clientwinssize && !(clientwins = realloc(clientwins,
+		(clientwinssize = 2 * clientwinslen + 64) * sizeof(Window))))
+		DIE("realloc failed.\n");
+	clientwins[clientwinslen++] = c->win;
+	doclientlist = 1;
 	/* some windows require this */
-	XMoveResizeWindow(dpy, c->win, c->fx + 2 * sw, c->fy, c->fw, c->fh);
+	XMoveResizeWindow(dpy, c->win, (c->sx = c->fx + 2 * sw), (c->sy = c->fy),
+		c->fw, c->fh);
 	PROPSET(c->win, WMState, xatom[WMState], 32, state, 2);
 	resize(c, c->fx, c->fy, c->fw, c->fh, 0);
-	if (getatomprop(c, xatom[NetWMState]) == xatom[NetWMFullscreen])
+	if (full)
 		setfullscreen(c, 1);
 	XMapWindow(dpy, c->win);
+	if (restoring) return; /* left to the end of the pass (see restoresession) */
 	restack(c, CliRaise);
 	launcher(&(Arg){.i = 0});
 }
 
 
+/**
+ * Handle pointer motion and enter events.
+ * These track the pointer position, button state, and the
+ * top level window under the pointer, for motion processing.
+ * Motion events only come from the pointer over the root
+ * window and the bar, or from anywhere while the pointer
+ * is grabbed (see grabresize), and are otherwise followed
+ * from raw motion (see exthandler). Enter events only track
+ * the window, since windows can move under a still pointer.
+ */
+void motionnotify(XEvent *e) {
+	#define PTRTRACK(E) {ptrdx += E.x_root - ptrx; ptrdy += E.y_root - ptry;\
+		ptrx = E.x_root; ptry = E.y_root; ptrmask = E.state;\
+		ptrwin = E.window == root ? E.subwindow : E.window;}
+	if (e->type == MotionNotify) {
+		PTRTRACK(e->xmotion)
+		domotion = ptrsync = 1; /* defer motion processing */
+	} else {
+		PTRTRACK(e->xcrossing)
+		ptrdx = ptrdy = 0;
+	}
+}
+
+
 /**
  * Handle property notify events.
  * This manages the following situations:
  *  - update status bar message (root window name changes)
  *  - update size hints
  *  - fullscreen state changes
+ * Queued events for the same window and property are
+ * collapsed into the latest one.
  */
 void propertynotify(XEvent *e) {
 	Client *c;
+	XEvent last = *e;
 	XPropertyEvent *ev = &e->xproperty;
 
+	while (XCheckIfEvent(dpy, e, samepropevent, (XPointer)&last))
+		traceevent(e);
+
 	/* handle bar status message updates */
 	if ((ev->window == root) && (ev->atom == XA_WM_NAME))
 		updatestatus();
@@ -1414,14 +2718,44 @@ void propertynotify(XEvent *e) {
 	if (ev->state == PropertyDelete || !(c = wintoclient(ev->window))) return;
 	/* update size hints for later respecting during resizing */
 	if (ev->atom == XA_WM_NORMAL_HINTS)
-		updatesizehints(c);
+		updatesizehints(c, NULL);
+	/* update the supported protocols for later messaging */
+	else if (ev->atom == xatom[WMProtocols])
+		updateprotocols(c, NULL, 0);
+	/* restack for a changed compositor bypass hint (see restack) */
+	else if (ev->atom == xatom[NetWMBypassCompositor]) {
+		c->bypass = getprop(c, xatom[NetWMBypassCompositor], XA_CARDINAL);
+		restack(NULL, CliNone);
+	}
 	/* make client fullscreen if needed */
 	else if (ev->atom == xatom[NetWMWindowType]
-	&& getatomprop(c, xatom[NetWMState]) == xatom[NetWMFullscreen])
+	&& getprop(c, xatom[NetWMState], XA_ATOM) == xatom[NetWMFullscreen])
 		setfullscreen(c, 1);
 }
 
 
+/**
+ * Handle XRandR screen and output change events.
+ * These come in bursts (e.g. when docking), so they are only
+ * collected here, and applied once settled (see updatescreen).
+ */
+void rrnotify(XEvent *e) {
+	XRRUpdateConfiguration(e);
+	screenat = nsnow() + SCREENWAIT * 1000000LL;
+}
+
+
+/**
+ * Handle the alarm of the dragged client's sync counter,
+ * recording the value it reached (see dragframe).
+ */
+void syncnotify(XEvent *e) {
+	XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)e;
+	if (ev->alarm == dragalarm)
+		dragdone = SYNCVALUE(ev->counter_value);
+}
+
+
 /**
  * Handle unmap notify requests.
  * Unmapped windows get removed and cleaned up after.
@@ -1448,17 +2782,30 @@ void unmapnotify(XEvent *e) {
  *       - DragSize: resize the window w and h sizes.
  */
 void grabresize(const Arg *arg) {
+	XSyncValue v;
+
 	/* abort if already in the desired mode,
 	   or if there is no selected window, or its fullscreen. */
 	if (ctrlmode == arg->i || !sel || sel->full) return;
 	/* set the drag mode so future motion applies to the action */
 	ctrlmode = arg->i;
-	/* grab pointer and show resize cursor */
-	XGrabPointer(dpy, root, True, ButtonPressMask,
+	/* grab pointer with motion tracking, and show resize cursor */
+	XGrabPointer(dpy, root, True, ButtonPressMask|PointerMotionMask,
 		GrabModeAsync, GrabModeAsync, None, cursize, CurrentTime);
-	if (ctrlmode != WinEdge)
+	if (ctrlmode != WinEdge) {
+		/* resync the pointer, which might have moved untracked */
+		if (MOUSEINF(ptrwin, ptrx, ptry, ptrmask))
+			ptrdx = ptrdy = 0;
+		/* pace the drag to the client's repainting, if it supports it */
+		dragsync = syncext && sel->protos & 1 << NetWMSyncRequest
+			? getprop(sel, xatom[NetWMSyncCounter], XA_CARDINAL) : 0;
+		if (dragsync && XSyncQueryCounter(dpy, dragsync, &v))
+			dragdone = dragval = SYNCVALUE(v);
+		else dragsync = 0;
+		dragsent = 0;
 		/* bring the window to the top */
 		restack(sel, CliRaise);
+	}
 }
 
 
@@ -1467,17 +2814,20 @@ void grabresize(const Arg *arg) {
  */
 void killclient(const Arg *arg) {
 	const Client *c = arg->v ? arg->v : sel;
-	if (c && !sendevent(c, xatom[WMDelete]))
+	if (c && !sendevent(c, WMDelete))
 		XKillClient(dpy, c->win);
 }
 
 /**
  * Switch the bar into launcher mode for
  * selecting commands to launch.
+ * The commands are loaded from the PATH when it is first shown.
  * @arg: contains i parameter identifying whether to show
  *       or hide the launcher.
  */
 void launcher(const Arg *arg) {
+	if (arg->i && !cmdslen)
+		loadcmds();
 	barcmds = arg->i;
 	drawbar();
 	if (!barcmds) {
@@ -1511,16 +2861,41 @@ void quit(const Arg *arg) {
 
 
 /**
- * Launch a child process.
+ * Restart the window manager, keeping the client windows open
+ * and restoring their state (see savesession and restoresession).
+ * This is useful for loading a changed config plugin.
+ */
+void restart(const Arg *arg) {
+	end = restarting = 1;
+}
+
+
+/**
+ * Launch a child process, in its own session.
+ * This uses posix_spawn rather than fork, so launching doesn't copy
+ * the window manager's memory, and the X connection and status
+ * provider file descriptors are closed in the child.
  * @arg: contains char array v parameter with the
  *       the command and arguments to launch.
  */
 void spawn(const Arg *arg) {
-	if (fork() != 0) return;
-	close(ConnectionNumber(dpy));
-	setsid();
-	execvp((*(char***)arg->v)[0], *(char ***)arg->v);
-	exit(EXIT_FAILURE);
+	char **argv = *(char ***)arg->v;
+	int i, err;
+	pid_t pid;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t fa;
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addclose(&fa, ConnectionNumber(dpy));
+	for (i = 1; i <= provslen; i++)
+		if (pfds[i].fd >= 0)
+			posix_spawn_file_actions_addclose(&fa, pfds[i].fd);
+	if ((err = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ)))
+		fprintf(stderr, "filetwm: cannot spawn %s: %s\n", argv[0], strerror(err));
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&attr);
 }
 
 
@@ -1544,16 +2919,16 @@ void stackgrab(const Arg *arg) {
  *       to cycle (1 -> next, -1 -> previous).
  */
 void stackshift(const Arg *arg) {
-	Client *c = NULL, *r;
+	int i;
 
-	#define LOOP(C) (C->next ? C->next : clients)
 	if (!sel) return;
-	if (arg->i > 0)
-		for (c = LOOP(sel); c && !ISVISIBLE(c); c = LOOP(c));
-	else
-		for (r = LOOP(sel); r != sel; r = LOOP(r)) if (ISVISIBLE(r)) c = r;
-	if (!c) return;
-	restack(c, CliRaise);
+	/* find the next or previous visible client, around the list */
+	updatevis();
+	for (i = 0; i < vislen && vis[i] != sel; i++);
+	if (i == vislen)
+		i = arg->i > 0 ? vislen - 1 : 0;
+	if (vislen)
+		restack(vis[(i + (arg->i > 0 ? 1 : vislen - 1)) % vislen], CliRaise);
 }
 
 
@@ -1565,6 +2940,7 @@ void stackshift(const Arg *arg) {
 void tag(const Arg *arg) {
 	if (sel && arg->ui & TAGMASK) {
 		sel->tags = arg->ui & TAGMASK;
+		visstale = hidestale = 1;
 		arrange(NULL, 0);
 	}
 }
@@ -1600,6 +2976,7 @@ void togglefullscreen(const Arg *arg) {
 void toggletag(const Arg *arg) {
 	if (sel && sel->tags ^ (arg->ui & TAGMASK)) {
 		sel->tags = sel->tags ^ (arg->ui & TAGMASK);
+		visstale = hidestale = 1;
 		arrange(NULL, 0);
 	}
 }
@@ -1612,6 +2989,7 @@ void toggletag(const Arg *arg) {
  */
 void view(const Arg *arg) {
 	tagset = arg->ui & TAGMASK;
+	visstale = hidestale = 1;
 	drawbar();
 	restack(NULL, CliRaise); /* reselect raised window */
 	arrange(NULL, 0);
@@ -1638,6 +3016,7 @@ void viewtagshift(const Arg *arg) {
 	if (sel)
 		sel->tags = TAGSHIFT(sel->tags, arg->i);
 	tagset = TAGSHIFT(tagset, arg->i) & TAGMASK;
+	visstale = hidestale = 1;
 	drawbar();
 	restack(sel, CliRaise);
 	arrange(NULL, 0);
@@ -1663,27 +3042,12 @@ void zoom(const Arg *arg) {
  * ready for the event loop.
  */
 void setup(void) {
-	int screen, xre, i, j = 0, s;
+	int screen, i, ximinor = 1;
 	unsigned char xi[XIMaskLen(XI_LASTEVENT)] = {0};
 	char tmppath[4096] = {0};
 	XIEventMask evm;
 	Atom utf8string;
 	void (*conf)(void);
-	DIR *dir;
-	struct dirent *f;
-
-	/* populate the cmds array with all the commands from
-	   the PATH environment variable */
-	for (i = 0; i < strlen(getenv("PATH")); i += s + 1) {
-		/* skip paths that are too long (4096 characters) */
-		if ((s = strcspn(&getenv("PATH")[i], ":\0")) > 4096 - 1) continue;
-		strncpy(tmppath, &getenv("PATH")[i], s);
-		tmppath[s] = '\0';
-		for (dir = opendir(tmppath); dir && ((f = readdir(dir)) && j < NUMCMDS);)
-			if (f->d_name[0] != '.')
-				strncpy(cmds[j++], f->d_name, LENCMD-1);
-		if (dir) closedir(dir);
-	}
 
 	/* set the FILETWM environment variable to the path of this
 	   executable so launched commands can refer to it's location */
@@ -1693,8 +3057,15 @@ void setup(void) {
 	if (!(dpy = XOpenDisplay(NULL)))
 		DIE("filetwm: cannot open display.\n");
 
+	/* record an event trace, if asked (see traceevent), closed on exec
+	   so launched commands and restarts don't inherit it */
+	if (getenv("FILETWMTRACE") && !(trace = fopen(getenv("FILETWMTRACE"), "ae")))
+		DIE("filetwm: cannot open the event trace.\n");
+
 	/* register handler to clean up any zombies immediately */
 	sigchld(0);
+	/* register handler for dumping statistics */
+	sigstats(0);
 
 	/* Load configs.
 	   First load the default included config.
@@ -1708,6 +3079,8 @@ void setup(void) {
 		conf();
 	else if (access(".config/filetwmconf.so", F_OK) == 0)
 		DIE(dlerror());
+	/* load any status text provider plugins */
+	loadstatus();
 
 	/* init screen and display */
 	XSetErrorHandler(xerror);
@@ -1715,26 +3088,33 @@ void setup(void) {
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drawable = XCreatePixmap(dpy, root, sw, sh, DefaultDepth(dpy, screen));
-	drawablexft = XftDrawCreate(dpy, drawable, DefaultVisual(dpy, screen),
-		DefaultColormap(dpy, screen));
 	gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, gc, 1, LineSolid, CapButt, JoinMiter);
 	if (!(xfont = XftFontOpenName(dpy, screen, font)))
 		DIE("font couldn't be loaded.\n");
-	/* init monitor layout */
-	if (MONNULL(mons[0])) {
+	for (i = 0; i < tagslen; i++)
+		tagsw[i] = TEXTW(tags[i]);
+	/* init the bar's back buffer (of the bar size) */
+	resizebar();
+	/* init monitor layout, detected if it isn't hard configured */
+	if ((monauto = MONNULL(mons[0])))
 		updatemonitors();
-		/* select xrandr events (if monitor layout isn't hard configured) */
-		if (XRRQueryExtension(dpy, &xre, &di))
-			XRRSelectInput(dpy, root, RROutputChangeNotifyMask);
+	else updatemonindex();
+	/* select xrandr events for screen changes (see rrnotify) */
+	if (XRRQueryExtension(dpy, &rrbase, &di)) {
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask|RROutputChangeNotifyMask);
+		updaterate();
 	}
+	/* init sync counters for pacing drags (see dragframe) */
+	syncext = XSyncQueryExtension(dpy, &syncbase, &di)
+		&& XSyncInitialize(dpy, &di, &di);
 	/* init atoms */
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
 	xatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
 	xatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
 	xatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
 	xatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
+	xatom[FiletSession] = XInternAtom(dpy, "_FILETWM_SESSION", False);
 	xatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
 	xatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	xatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
@@ -1745,6 +3125,11 @@ void setup(void) {
 	xatom[NetWMWinDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	xatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
 	xatom[NetCliStack] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
+	xatom[NetWMSyncRequest] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	xatom[NetWMSyncCounter] =
+		XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
+	xatom[NetWMBypassCompositor] =
+		XInternAtom(dpy, "_NET_WM_BYPASS_COMPOSITOR", False);
 	/* init cursors */
 	curpoint = XCreateFontCursor(dpy, XC_left_ptr);
 	cursize = XCreateFontCursor(dpy, XC_sizing);
@@ -1774,25 +3159,70 @@ void setup(void) {
 	updatestatus();
 	/* select events */
 	XSelectInput(dpy, root, SubstructureRedirectMask|SubstructureNotifyMask
-		|ButtonPressMask|KeyPressMask|StructureNotifyMask|PropertyChangeMask);
-	/* prepare motion capture */
-	motion();
-	/* select xinput events */
+		|ButtonPressMask|KeyPressMask|StructureNotifyMask|PropertyChangeMask
+		|EnterWindowMask|PointerMotionMask|FocusChangeMask);
+	/* prepare motion capture, syncing the pointer and keyboard states */
+	MOUSEINF(ptrwin, ptrx, ptry, ptrmask);
+	XQueryKeymap(dpy, keydown);
+	/* select xinput events, from XI 2.1 taking the raw events of the
+	   master devices, which are sent even while another client has a grab */
 	if (XQueryExtension(dpy, "XInputExtension", &di, &di, &di)
-	&& XIQueryVersion(dpy, &(int){2}, &(int){0}) == Success) {
+	&& XIQueryVersion(dpy, &(int){2}, &ximinor) == Success) {
 		XISetMask(xi, XI_RawMotion);
 		XISetMask(xi, XI_RawButtonRelease);
+		XISetMask(xi, XI_RawKeyPress);
 		XISetMask(xi, XI_RawKeyRelease);
-		evm.deviceid = XIAllDevices;
+		evm.deviceid = ximinor >= 1 ? XIAllMasterDevices : XIAllDevices;
 		evm.mask_len = sizeof(xi);
 		evm.mask = xi;
 		XISelectEvents(dpy, root, &evm, 1);
+		/* and device changes, for following relative motion (see exthandler) */
+		memset(xi, 0, sizeof(xi));
+		XISetMask(xi, XI_HierarchyChanged);
+		evm.deviceid = XIAllDevices;
+		XISelectEvents(dpy, root, &evm, 1);
+		updatedevices();
 	}
 	grabkeys(NULL);
+	/* manage any open windows, restoring any saved session */
+	restoresession();
 	focus(NULL);
+}
 
-	/* launch the configured startup command */
-	spawn(&(Arg){.v = &startup});
+
+/**
+ * Handle an event taken from the queue, through its event handler,
+ * then do any deferred processing once the queue isn't busy.
+ */
+void dispatch(XEvent *ev) {
+	long long start = nsnow();
+	unsigned long req = NextRequest(dpy);
+
+	if (ev->type < LASTEvent) {
+		if (handler[ev->type])
+			handler[ev->type](ev); /* call handler */
+	} else if (ev->type == rrbase + RRScreenChangeNotify
+	|| ev->type == rrbase + RRNotify)
+		rrnotify(ev); /* extension events are beyond the handlers */
+	else if (syncext && ev->type == syncbase + XSyncAlarmNotify)
+		syncnotify(ev);
+	statadd(ev->type < LASTEvent ? ev->type : 0, start, req);
+	/* wait until the queue isn't busy to do deferred processing */
+	if (doarrange && !XQLength(dpy))
+		arrange(NULL, 0);
+	if (dorestack && !XQLength(dpy))
+		restack(NULL, CliNone);
+	if (doclientlist && !XQLength(dpy)) {
+		PROPSET(root, NetClientList, XA_WINDOW, 32, clientwins, clientwinslen);
+		doclientlist = 0;
+	}
+	if (domotion && !XQLength(dpy)) {
+		start = nsnow();
+		req = NextRequest(dpy);
+		motion();
+		domotion = 0;
+		statadd(StatMotion, start, req);
+	}
 }
 
 
@@ -1801,29 +3231,78 @@ void setup(void) {
  * command help, main loop, and exit cleanup.
  */
 int main(int argc, char *argv[]) {
+	int i, n, wait;
+	const char *exe;
+	Client *c;
 	XEvent ev;
 
 	if (argc != 1) DIE("usage: filetwm [-v]\n");
 
 	setup();
+	/* launch the configured startup command */
+	spawn(&(Arg){.v = &startup});
 
 	/* main event loop */
-	while (!end && !XNextEvent(dpy, &ev)) {
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
-		/* wait until the queue isn't busy to do motion processing */
-		if (domotion && !XQLength(dpy)) {
-			motion();
-			domotion = 0;
+	while (!end) {
+		/* dump any requested statistics (see sigstats), even when the
+		   signal interrupted waiting rather than following an event */
+		if (dostats)
+			dumpstats();
+		/* apply any due drag frame and settled screen changes, then if no
+		   events are queued, wait for events, the status providers,
+		   the next paced drag frame, or screen changes to settle */
+		wait = dragframe();
+		if ((i = updatescreen()) >= 0)
+			wait = wait < 0 ? i : MIN(wait, i);
+		if (!XPending(dpy)) {
+			if (poll(pfds, provslen + 1, wait) <= 0)
+				continue;
+			for (i = 0, n = 0; i < provslen; i++) {
+				if (pfds[i+1].revents & (POLLIN|POLLHUP) && ++n)
+					provs[i].text(provs[i].out, sizeof provs[i].out);
+				/* stop watching a provider that hung up or failed,
+				   keeping its last text */
+				if (pfds[i+1].revents & (POLLHUP|POLLERR|POLLNVAL))
+					pfds[i+1].fd = -1;
+			}
+			if (n) updatestatus();
+			if (!pfds[0].revents) continue;
 		}
+		XNextEvent(dpy, &ev);
+		traceevent(&ev);
+		dispatch(&ev);
 	}
 
-	/* cleanup */
+	/* only restart if filetwm can be run again, otherwise quit
+	   normally instead of leaving the windows unmanaged */
+	exe = getenv("FILETWM") ? getenv("FILETWM") : "filetwm";
+	if (restarting && !(exe = execpath(exe))) {
+		fputs("filetwm: cannot restart, quitting.\n", stderr);
+		restarting = 0;
+	}
+	/* handle the events already queued, so the session is up to date
+	   and arranging isn't deferred (see arrange) */
+	while (XQLength(dpy)) {
+		XNextEvent(dpy, &ev);
+		traceevent(&ev);
+		dispatch(&ev);
+	}
+	/* cleanup, closing the clients (without waiting on them), unless
+	   restarting (see restart), then tearing down the client state once,
+	   showing all workspaces so closing clients can prompt on screen */
+	if (restarting)
+		savesession();
 	view(&(Arg){.ui = ~0});
-	while (clients) {
-		killclient(&(Arg){.v = clients});
-		unmanage(clients);
+	if (!restarting)
+		for (c = clients; c; c = c->next)
+			killclient(&(Arg){.v = c});
+	while ((c = clients)) {
+		clients = c->next;
+		freeclient(c);
 	}
+	memset(wins, 0, sizeof wins);
+	sel = pinned = NULL;
+	clientwinslen = 0;
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	XUnmapWindow(dpy, barwin);
 	XDestroyWindow(dpy, barwin);
@@ -1836,7 +3315,16 @@ int main(int argc, char *argv[]) {
 	XftDrawDestroy(drawablexft);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, xatom[NetActiveWindow]);
+	XDeleteProperty(dpy, root, xatom[NetClientList]);
 	XCloseDisplay(dpy);
+	if (trace) fclose(trace);
+	if (restarting) {
+		/* the new instance opens its own status providers */
+		for (i = 1; i <= provslen; i++)
+			if (pfds[i].fd >= 0) close(pfds[i].fd);
+		execl(exe, "filetwm", NULL);
+		DIE("filetwm: cannot restart.\n");
+	}
 
 	return EXIT_SUCCESS;
 }